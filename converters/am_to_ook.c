@@ -6,6 +6,28 @@
  * the MSB the first byte and the LSB the last. Down-sampling can be used to
  * capture a wider band.
  *
+ * Instead of a set threshold an adaptive threshold can be used, which tracks
+ * the noise floor and signal peak level to cope with changing receiver gain.
+ *
+ * The AM levels are read as 16-bit unsigned integers, other sample formats can
+ * be selected with -f, see am_format.h.
+ *
+ * Instead of AM levels, raw complex IQ samples, like rtl_sdr writes, can be
+ * used as input with -I. The envelope of the signal is then used as AM level,
+ * so no separate AM demodulator is needed.
+ *
+ * On a channel that is idle most of the time, -g replaces stretches of noise
+ * with '0', see ook_slicer_set_gate(). Noise then no longer shows up as short
+ * pulses in the output, which keeps edge streams small and saves the decoders
+ * a lot of work. In an edge stream an idle stretch is a single 0 record.
+ *
+ * Alternatively the output can be written as edge stream, see edge_stream.h,
+ * which only stores the length of every pulse.
+ *
+ * When the output is decoded live, -i keeps the delay low. Input is then
+ * converted as soon as it arrives and the output is flushed after every block,
+ * instead of waiting for whole blocks and a full stdio buffer.
+ *
  * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
  * All rights reserved.
  *
@@ -37,8 +59,235 @@
 #include <stdbool.h>
 #include <string.h>
 #include <getopt.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "am_format.h"
+#include "edge_scan.h"
+#include "edge_stream.h"
+#include "input.h"
+#include "iq_envelope.h"
+#include "ook_slicer.h"
+#include "ook_stats.h"
 
 #define THRESHOLD 0x4000
+#define HYSTERESIS 20
+// Chunks kept after an active chunk when gating idle chunks
+#define GATE_HOLD 2
+
+// Approximate number of samples per chunk in multi-threaded mode
+#define PAR_CHUNK_SAMPLES (1 << 20)
+
+/*
+ * Convert sliced words to output bytes
+ *
+ * Packed output stores the words big-endian, unpacked output uses one byte per
+ * bit. Only the first nbits bits of the last word are used.
+ */
+static size_t words_to_bytes(const uint64_t *words, size_t nbits,
+				bool output_unpacked, uint8_t *out)
+{
+	size_t o = 0;
+	size_t i;
+
+	if (output_unpacked) {
+		for (i = 0; i < nbits; i++) {
+			out[o++] = (words[i / 64] >> (63 - (i & 63))) & 1;
+		}
+	} else {
+		for (i = 0; i < nbits; i += 8) {
+			out[o++] = words[i / 64] >> (56 - (i & 63));
+		}
+	}
+
+	return o;
+}
+
+/*
+ * Multi-threaded conversion of files
+ *
+ * The memory mapped input is split in chunks that are a multiple of 64
+ * down-sample windows long, so every chunk produces a whole number of output
+ * words and can be sliced independently. Workers pick up chunks in order and
+ * the main thread writes the results in order. At most two chunks per worker
+ * are in flight.
+ */
+struct par_slot {
+	uint64_t *words;
+	uint8_t *out;
+	size_t olen;
+	bool done;
+};
+
+struct par_ctx {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	const uint16_t *samples;
+	uint64_t nsamples;
+	size_t chunk_samples;
+	size_t nchunks;
+	uint16_t threshold;
+	int downsample_rate;
+	bool output_unpacked;
+
+	struct par_slot *slots;
+	size_t nslots;
+	size_t next_chunk;
+	size_t write_chunk;
+	int error;
+};
+
+static void *par_worker(void *arg)
+{
+	struct par_ctx *ctx = (struct par_ctx *) arg;
+	struct ook_slicer slicer;
+	struct par_slot *slot;
+	uint64_t start;
+	size_t n;
+	size_t k;
+	size_t nbits;
+
+	for (;;) {
+		pthread_mutex_lock(&ctx->lock);
+		while (ctx->next_chunk < ctx->nchunks &&
+			ctx->next_chunk >= ctx->write_chunk + ctx->nslots &&
+			! ctx->error)
+		{
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		}
+		if (ctx->next_chunk >= ctx->nchunks || ctx->error) {
+			pthread_mutex_unlock(&ctx->lock);
+			return NULL;
+		}
+		k = ctx->next_chunk++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		slot = &ctx->slots[k % ctx->nslots];
+		start = (uint64_t) k * ctx->chunk_samples;
+		n = ctx->chunk_samples;
+		if (n > ctx->nsamples - start)
+			n = ctx->nsamples - start;
+
+		ook_slicer_init(&slicer, ctx->threshold, ctx->downsample_rate);
+		nbits = ook_slicer_push(&slicer, &ctx->samples[start], n,
+					slot->words) * 64;
+		if (k == ctx->nchunks - 1) {
+			nbits += ook_slicer_flush(&slicer, &slot->words[nbits / 64]);
+		}
+		slot->olen = words_to_bytes(slot->words, nbits,
+					ctx->output_unpacked, slot->out);
+
+		pthread_mutex_lock(&ctx->lock);
+		slot->done = true;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+}
+
+/*
+ * Convert nsamples samples using nthreads worker threads
+ *
+ * Returns 0 on success, -1 on error with errno set.
+ */
+static int convert_parallel(const uint16_t *samples, uint64_t nsamples,
+				uint16_t threshold, int downsample_rate,
+				bool output_unpacked, int nthreads, FILE *ofp)
+{
+	struct par_ctx ctx;
+	pthread_t *threads;
+	size_t unit = (size_t) downsample_rate * 64;
+	size_t max_words;
+	size_t i;
+	int nstarted = 0;
+	int err = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.samples = samples;
+	ctx.nsamples = nsamples;
+	ctx.chunk_samples = (PAR_CHUNK_SAMPLES / unit + 1) * unit;
+	ctx.nchunks = (nsamples + ctx.chunk_samples - 1) / ctx.chunk_samples;
+	ctx.threshold = threshold;
+	ctx.downsample_rate = downsample_rate;
+	ctx.output_unpacked = output_unpacked;
+	ctx.nslots = nthreads * 2;
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+
+	max_words = ook_slicer_max_words(ctx.chunk_samples);
+	ctx.slots = calloc(ctx.nslots, sizeof(*ctx.slots));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (ctx.slots == NULL || threads == NULL) {
+		err = ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < ctx.nslots; i++) {
+		struct par_slot *slot = &ctx.slots[i];
+		slot->words = malloc(max_words * sizeof(uint64_t));
+		slot->out = malloc(max_words * 64);
+		if (slot->words == NULL || slot->out == NULL) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+	for (nstarted = 0; nstarted < nthreads; nstarted++) {
+		if ((err = pthread_create(&threads[nstarted], NULL, par_worker,
+						&ctx)) != 0) {
+			break;
+		}
+	}
+
+	for (i = 0; i < ctx.nchunks && nstarted > 0; i++) {
+		struct par_slot *slot = &ctx.slots[i % ctx.nslots];
+
+		pthread_mutex_lock(&ctx.lock);
+		while (! slot->done && ! ctx.error) {
+			pthread_cond_wait(&ctx.cond, &ctx.lock);
+		}
+		err = ctx.error;
+		pthread_mutex_unlock(&ctx.lock);
+		if (err != 0)
+			break;
+
+		if (slot->olen > 0 && fwrite(slot->out, 1, slot->olen, ofp) != slot->olen) {
+			err = errno ? errno : EIO;
+		}
+
+		pthread_mutex_lock(&ctx.lock);
+		slot->done = false;
+		ctx.write_chunk++;
+		if (err != 0)
+			ctx.error = err;
+		pthread_cond_broadcast(&ctx.cond);
+		pthread_mutex_unlock(&ctx.lock);
+		if (err != 0)
+			break;
+	}
+
+	while (nstarted > 0) {
+		pthread_join(threads[--nstarted], NULL);
+	}
+
+out:
+	if (ctx.slots != NULL) {
+		for (i = 0; i < ctx.nslots; i++) {
+			free(ctx.slots[i].words);
+			free(ctx.slots[i].out);
+		}
+	}
+	free(ctx.slots);
+	free(threads);
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.lock);
+
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
 
 void usage(char *my_name) {
 	fprintf(stderr, "Convert AM levels to Binary stream\n");
@@ -49,11 +298,38 @@ void usage(char *my_name) {
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "\t-a            Analyse input file and print "
 					"summary\n");
+	fprintf(stderr, "\t-f <format>   Format of AM levels: u8, s8, u16le, "
+					"u16be, s16le, s16be,\n");
+	fprintf(stderr, "\t              s32le or f32le (default: u16le)\n");
+	fprintf(stderr, "\t-I <format>   Input is complex IQ instead of AM "
+					"levels, format is cu8\n");
+	fprintf(stderr, "\t              or cs16\n");
+	fprintf(stderr, "\t-p <samples>  Print analysis every given number "
+					"of samples\n");
 	fprintf(stderr, "\t-d <ratio>    Down-sample with given ratio\n");
 	fprintf(stderr, "\t-t <level>    Set threshold above which a sample "
 					"is considered '1'\n");
+	fprintf(stderr, "\t-A            Adapt threshold to the signal level "
+					"instead of using -t\n");
+	fprintf(stderr, "\t-H <percent>  Hysteresis of adaptive threshold "
+					"(default: %d)\n", HYSTERESIS);
+	fprintf(stderr, "\t-g <count>    Treat chunks of %d samples with "
+					"fewer than count samples\n",
+					OOK_SLICER_CHUNK);
+	fprintf(stderr, "\t              above the threshold as idle\n");
 	fprintf(stderr, "\t-u            Don't pack output but use one bit "
 					"per byte\n");
+	fprintf(stderr, "\t-e            Output edge stream instead of bit "
+					"stream\n");
+	fprintf(stderr, "\t-s <rate>     Input sample rate in Hz, stored in "
+					"edge stream header\n");
+	fprintf(stderr, "\t-j <threads>  Use multiple threads, only when the "
+					"input is a file\n");
+	fprintf(stderr, "\t-b <size>     Read input in blocks of given size\n");
+	fprintf(stderr, "\t-i            Low latency mode, convert input as "
+					"soon as it arrives\n");
+	fprintf(stderr, "\t              and flush output after every "
+					"block\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "When input or output are not specified or equal to\n");
 	fprintf(stderr, "'-', stdin and stdout are used\n");
@@ -61,38 +337,81 @@ void usage(char *my_name) {
 
 int main(int argc, char *argv[])
 {
-	FILE *ifp = stdin;
+	struct input in;
+	const char *ifile = NULL;
 	FILE *ofp = stdout;
 
 	int opt;
 	bool do_analyse = false;
 	bool output_unpacked = false;
+	bool output_edges = false;
+	uint32_t sample_rate = 0;
 	int downsample_rate = 1;
 	uint16_t threshold = THRESHOLD;
+	bool adaptive = false;
+	int hysteresis = HYSTERESIS;
+	unsigned int gate_min = 0;
+	int nthreads = 1;
+	size_t block_size = 0;
+	bool low_latency = false;
+	struct iq_envelope env;
+	bool iq_input = false;
+	struct am_format fmt;
+	bool fmt_set = false;
+	size_t sample_size = 2;
+	uint16_t *levels = NULL;
 
-	struct {
-		unsigned int min_unsigned;
-		unsigned int max_unsigned;
-		int min_signed;
-		int max_signed;
-	} stats = { 0 };
+	struct ook_stats *stats = NULL;
+	uint64_t report_interval = 0;
+	uint64_t report_cnt = 0;
+	char slicer_desc[64];
 
-	int downsample_threshold = 1;
-	int downsample_cnt = 0;
-	int one_cnt = 0;
+	struct ook_slicer slicer;
+	struct edge_stream_header hdr;
+	struct edge_writer writer;
+	struct edge_scan es;
+	struct timeval now;
 
-	size_t len;
-	uint8_t buf[4096];
-	uint16_t *vals;
-	size_t i;
-	uint8_t b;
-	int j;
+	ssize_t len;
+	const uint8_t *data;
+	const uint16_t *vals;
+	size_t nvals;
+	uint64_t *words;
+	uint8_t *obuf;
+	size_t nwords;
+	int nbits;
+	size_t olen;
 
-	while ((opt = getopt(argc, argv, "ad:t:uh")) != -1) {
+	while ((opt = getopt(argc, argv, "af:I:p:d:t:AH:g:ues:j:b:ih")) != -1) {
 		switch (opt) {
 		case 'a':
 			do_analyse = true;
 			break;
+		case 'f':
+			if (am_format_init(&fmt, optarg) != 0) {
+				fprintf(stderr, "Unknown sample format: %s\n",
+						optarg);
+				exit(EXIT_FAILURE);
+			}
+			fmt_set = true;
+			break;
+		case 'I':
+			if (iq_envelope_init(&env, optarg) != 0) {
+				fprintf(stderr, "Unknown IQ format: %s\n",
+						optarg);
+				exit(EXIT_FAILURE);
+			}
+			iq_input = true;
+			sample_size = env.sample_size;
+			break;
+		case 'p':
+			report_interval = strtoll(optarg, NULL, 0);
+			if ((int64_t) report_interval <= 0) {
+				fprintf(stderr, "Report interval must be above "
+						"0 samples\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'd':
 			downsample_rate = strtol(optarg, NULL, 0);
 			if (downsample_rate <= 0) {
@@ -102,9 +421,41 @@ int main(int argc, char *argv[])
 		case 't':
 			threshold = strtol(optarg, NULL, 0);
 			break;
+		case 'A':
+			adaptive = true;
+			break;
+		case 'H':
+			hysteresis = strtol(optarg, NULL, 0);
+			if (hysteresis < 0 || hysteresis > 100) {
+				fprintf(stderr, "Hysteresis must be between "
+						"0 and 100 percent\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'g':
+			gate_min = strtoul(optarg, NULL, 0);
+			break;
 		case 'u':
 			output_unpacked = true;
 			break;
+		case 'e':
+			output_edges = true;
+			break;
+		case 's':
+			sample_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			nthreads = strtol(optarg, NULL, 0);
+			if (nthreads <= 0) {
+				nthreads = 1;
+			}
+			break;
+		case 'b':
+			block_size = strtol(optarg, NULL, 0);
+			break;
+		case 'i':
+			low_latency = true;
+			break;
 		case 'h':
 			usage(argv[0]);
 			exit(EXIT_SUCCESS);
@@ -115,6 +466,20 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (iq_input && fmt_set) {
+		fprintf(stderr, "Options -f and -I can't be combined\n");
+		exit(EXIT_FAILURE);
+	}
+	if (! fmt_set) {
+		am_format_init(&fmt, "u16le");
+	}
+	if (! iq_input) {
+		sample_size = fmt.sample_size;
+	}
+
+	// Keep blocks a whole number of samples
+	block_size = (block_size + sample_size - 1) / sample_size * sample_size;
+
 	if (argc - optind > 2) {
 		fprintf(stderr, "Too many arguments\n");
 		usage(argv[0]);
@@ -123,21 +488,19 @@ int main(int argc, char *argv[])
 
 	// Input file
 	if (argc - optind > 0) {
-		if (strcmp(argv[optind], "-") != 0) {
-			if ((ifp = fopen(argv[optind], "rb")) == NULL) {
-				perror("Failed opening input file");
-				exit(EXIT_FAILURE);
-			}
-		}
+		ifile = argv[optind];
 		optind++;
 	}
+	if (input_open(&in, ifile, block_size) != 0) {
+		perror("Failed opening input file");
+		exit(EXIT_FAILURE);
+	}
 
 	// Output file
 	if (argc - optind > 0 && ! do_analyse) {
 		if (strcmp(argv[optind], "-") != 0) {
 			if ((ofp = fopen(argv[optind], "wb")) == NULL) {
-				if (ifp != stdin)
-					fclose(ifp);
+				input_close(&in);
 				perror("Failed opening output file");
 				exit(EXIT_FAILURE);
 			}
@@ -145,66 +508,170 @@ int main(int argc, char *argv[])
 		optind++;
 	}
 
-	if (downsample_rate != 1) {
-		downsample_threshold = downsample_rate >> 1;
+	// The adaptive threshold, gate and edge stream depend on all previous
+	// samples. Input at an odd offset is converted sequentially.
+	if (nthreads > 1 && ! do_analyse && ! adaptive && gate_min == 0 &&
+	    ! output_edges && ! iq_input && fmt.convert_block == NULL &&
+	    (data = input_read_all(&in, sizeof(uint16_t), &olen)) != NULL)
+	{
+		if (convert_parallel((const uint16_t *) data, olen / 2,
+				threshold, downsample_rate, output_unpacked,
+				nthreads, ofp) != 0) {
+			perror("Failed converting input");
+			exit(EXIT_FAILURE);
+		}
+		goto done;
 	}
 
-	b=0;
-	j=0;
-	one_cnt=0;
-	downsample_cnt=0;
-	while ((len = fread(buf, 1, sizeof(buf), ifp)) > 0) {
+	words = malloc(ook_slicer_max_words(in.block_size / sample_size) *
+							sizeof(uint64_t));
+	obuf = malloc(ook_slicer_max_words(in.block_size / sample_size) * 64);
+	if (iq_input || fmt.convert_block != NULL) {
+		levels = malloc(in.block_size / sample_size * sizeof(uint16_t));
+	}
+	if (words == NULL || obuf == NULL ||
+	    ((iq_input || fmt.convert_block != NULL) && levels == NULL)) {
+		perror("Failed allocating buffers");
+		exit(EXIT_FAILURE);
+	}
+
+	if (low_latency && input_set_partial(&in, sample_size, -1) != 0) {
+		perror("Failed setting up input");
+		exit(EXIT_FAILURE);
+	}
+
+	ook_slicer_init(&slicer, threshold, downsample_rate);
+	if (adaptive) {
+		ook_slicer_set_adaptive(&slicer, hysteresis);
+	}
+	ook_slicer_set_gate(&slicer, gate_min, GATE_HOLD);
+
+	if (output_edges && ! do_analyse) {
+		hdr.sample_rate = (sample_rate + downsample_rate / 2) /
+						downsample_rate;
+		// Only a stream is assumed to be converted while captured
+		hdr.start_time = 0;
+		if (in.map == NULL) {
+			gettimeofday(&now, NULL);
+			hdr.start_time = (uint64_t) now.tv_sec * 1000000 +
+						now.tv_usec;
+		}
+		if (edge_writer_init(&writer, ofp, &hdr) != 0) {
+			perror("Failed writing output");
+			exit(EXIT_FAILURE);
+		}
+		edge_scan_init(&es, edge_writer_cb, &writer);
+	}
+
+	if (do_analyse) {
+		if ((stats = ook_stats_new()) == NULL) {
+			perror("Failed allocating statistics");
+			exit(EXIT_FAILURE);
+		}
+		if (adaptive) {
+			snprintf(slicer_desc, sizeof(slicer_desc),
+				"adaptive threshold, down-sample %d",
+				downsample_rate);
+		} else {
+			snprintf(slicer_desc, sizeof(slicer_desc),
+				"threshold %u, down-sample %d",
+				threshold, downsample_rate);
+		}
+	}
+
+	while ((len = input_read(&in, &data)) > 0) {
+		nvals = len / sample_size;
+		if (iq_input) {
+			iq_envelope(&env, data, nvals, levels);
+			vals = levels;
+		} else {
+			vals = am_format_convert(&fmt, data, nvals, levels);
+		}
 		//NOTE: From the doc's I expected the output to be signed, but
 		// the range of the AM demodulated data seems to be in the
 		// order of 0 -> (2^31 + a bit). So using unsigned.
-		vals = (uint16_t *) buf;
-		for (i = 0; i < len / 2; i++) {
-			if (do_analyse) {
-				if (vals[i] > stats.max_unsigned)
-					stats.max_unsigned = vals[i];
-				if (vals[i] < stats.min_unsigned)
-					stats.min_unsigned = vals[i];
-				if ((int16_t) vals[i] > stats.max_signed)
-					stats.max_signed = vals[i];
-				if ((int16_t) vals[i] < stats.min_signed)
-					stats.min_signed = vals[i];
-			} else {
-				if (vals[i] > threshold) {
-					one_cnt++;
+		if (do_analyse) {
+			const uint16_t *p = vals;
+			size_t left = nvals;
+
+			while (left > 0) {
+				size_t n = left;
+
+				// Split the block where the report is due
+				if (report_interval != 0 &&
+				    report_interval - report_cnt < n) {
+					n = report_interval - report_cnt;
 				}
-				if (++downsample_cnt == downsample_rate) {
-					b <<= 1;
-					if (one_cnt >= downsample_threshold) {
-						b |= 1;
-					}
-					if (++j == 8 || output_unpacked) {
-						fputc(b, ofp);
-						j = 0;
-						b = 0;
-					}
-					one_cnt = 0;
-					downsample_cnt = 0;
+
+				ook_stats_add_samples(stats, p, n);
+				nwords = ook_slicer_push(&slicer, p, n, words);
+				ook_stats_add_bits(stats, words, nwords * 64);
+				p += n;
+				left -= n;
+
+				report_cnt += n;
+				if (report_cnt == report_interval) {
+					ook_stats_print(stats, stdout,
+							slicer_desc);
+					putchar('\n');
+					fflush(stdout);
+					ook_stats_reset(stats);
+					report_cnt = 0;
 				}
 			}
+		} else if (output_edges) {
+			nwords = ook_slicer_push(&slicer, vals, nvals, words);
+			edge_scan_push(&es, words, nwords * 64);
+			if (low_latency && (edge_writer_flush(&writer) != 0 ||
+						fflush(ofp) != 0)) {
+				perror("Failed writing output");
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			nwords = ook_slicer_push(&slicer, vals, nvals, words);
+			olen = words_to_bytes(words, nwords * 64,
+						output_unpacked, obuf);
+			if (olen > 0 && fwrite(obuf, 1, olen, ofp) != olen) {
+				perror("Failed writing output");
+				exit(EXIT_FAILURE);
+			}
+			if (low_latency && olen > 0 && fflush(ofp) != 0) {
+				perror("Failed writing output");
+				exit(EXIT_FAILURE);
+			}
 		}
 	}
 
 	if (do_analyse)	{
-		printf("Analysis\n");
-		printf("--------\n");
-		printf("Unsigned Minimal level: %u\n", stats.min_unsigned);
-		printf("Unsigned Maximum level: %u\n", stats.max_unsigned);
-		printf("Signed Minimal level: %u\n", stats.min_signed);
-		printf("Signed Maximum level: %u\n", stats.max_signed);
-	} else {
-		if (j != 0) {
-			b <<= (8-j);
-			fputc(b, ofp);
+		nbits = ook_slicer_flush(&slicer, words);
+		ook_stats_add_bits(stats, words, nbits);
+		if (report_interval == 0 || report_cnt != 0) {
+			ook_stats_print(stats, stdout, slicer_desc);
+		}
+		ook_stats_free(stats);
+	} else if (output_edges) {
+		nbits = ook_slicer_flush(&slicer, words);
+		edge_scan_push(&es, words, nbits);
+		edge_scan_flush(&es);
+		if (edge_writer_flush(&writer) != 0) {
+			perror("Failed writing output");
+			exit(EXIT_FAILURE);
 		}
+	} else {
+		nbits = ook_slicer_flush(&slicer, words);
+		olen = words_to_bytes(words, nbits, output_unpacked, obuf);
+		fwrite(obuf, 1, olen, ofp);
+	}
+	if (len < 0) {
+		perror("Failed reading input");
+		exit(EXIT_FAILURE);
 	}
 
-	if (ifp != stdin)
-		fclose(ifp);
+	free(words);
+	free(obuf);
+	free(levels);
+done:
+	input_close(&in);
 	if (ofp != stdout)
 		fclose(ofp);
 	return EXIT_SUCCESS;
@@ -3,8 +3,23 @@
  *
  * Convert the FX2 logger binary trace format to a VCD file so it can be used
  * in GTKWave.
- * Usage: ./dat_to_vcd < in.dat > out.vcd
- * TODO: Currently the sample rate is fixed on 1 sample per 41.666667 us(24 KHz).
+ *
+ * The input is scanned for transitions a word at a time, and the value changes
+ * are formatted into a large output buffer without going through printf().
+ *
+ * With -e the input is an edge stream, as written by am_to_ook -e, instead of a
+ * bit stream. The timescale and date are then taken from the edge stream
+ * header if known.
+ *
+ * Besides the raw bit stream the output can contain the bit stream after the
+ * low-pass filter used by decode_somfy (-l), and the state of the Somfy decoder
+ * (-s). When the filter is enabled the decoder is fed the filtered bit stream.
+ *
+ * When compiled with WITH_FST defined, the -F option writes a FST file instead,
+ * which is compressed and loads a lot faster in GTKWave. This requires linking
+ * with fstapi.c, fastlz.c and lz4.c from the GTKWave sources and zlib.
+ *
+ * Usage: ./dat_to_vcd [-els] [-b <size>] [-L <depth>:<low>[:<high>]] [-T <timescale>] < in.dat > out.vcd
  *
  * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
  * All rights reserved.
@@ -32,42 +47,576 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <getopt.h>
 
-int main(int argc, char *argv[])
+#include "edge_scan.h"
+#include "edge_stream.h"
+#include "input.h"
+#include "lpf.h"
+#include "somfy.h"
+
+#ifdef WITH_FST
+#include "fstapi.h"
+#endif
+
+// Duration of one sample, default is 1 sample per 41.666667 us (24 KHz)
+#define TIMESCALE "41667 ns"
+
+#define OUT_BUF_SIZE (1 << 16)
+// Longest value change: '#', 20 digits, '\n', 'b', value, ' ', id, '\n'
+#define MAX_CHANGE_LEN 64
+// Maximal number of pending events in edge stream mode
+#define MAX_EVENTS 4096
+
+enum signal {
+	SIG_RAW,
+	SIG_LPF,
+	SIG_STATE,
+	NUM_SIGNALS
+};
+
+static const struct {
+	char id;
+	int width;
+	const char *type;
+	const char *name;
+} signals[NUM_SIGNALS] = {
+	{ '!', 1, "wire", "1" },
+	{ '"', 1, "wire", "lpf" },
+	{ '#', 2, "reg", "somfy_state" },
+};
+
+static const struct {
+	const char *name;
+	int exponent;
+} units[] = {
+	{ "s", 0 },
+	{ "ms", -3 },
+	{ "us", -6 },
+	{ "ns", -9 },
+	{ "ps", -12 },
+	{ "fs", -15 },
+	{ NULL, 0 }
+};
+
+struct event {
+	uint64_t time;
+	uint8_t sig;
+	uint8_t val;
+};
+
+struct event_list {
+	struct event *ev;
+	size_t len;
+	size_t size;
+};
+
+/* Source of level changes, the raw or the filtered bit stream */
+struct source {
+	int sig;
+	uint64_t time;
+	struct edge_scan es;
+	struct event_list events;
+
+	// Decoder fed with the level changes, or NULL
+	struct somfy_decoder *dec;
+};
+
+struct wave_out {
+	bool enabled[NUM_SIGNALS];
+	uint64_t last_time;
+	bool have_time;
+
+#ifdef WITH_FST
+	void *fst;
+	fstHandle handles[NUM_SIGNALS];
+	uint64_t time_mult;
+#endif
+
+	size_t len;
+	char buf[OUT_BUF_SIZE];
+};
+
+static void event_add(struct event_list *l, uint64_t time, int sig, int val)
+{
+	if (l->len == l->size) {
+		l->size = l->size ? l->size * 2 : 1024;
+		if ((l->ev = realloc(l->ev, l->size * sizeof(*l->ev))) == NULL) {
+			perror("Failed allocating events");
+			exit(EXIT_FAILURE);
+		}
+	}
+	l->ev[l->len].time = time;
+	l->ev[l->len].sig = sig;
+	l->ev[l->len].val = val;
+	l->len++;
+}
+
+static void source_edge_cb(void *arg, int new_level, uint64_t len)
+{
+	struct source *src = (struct source *) arg;
+	enum somfy_state state;
+
+	src->time += len;
+	event_add(&src->events, src->time, src->sig, new_level);
+
+	if (src->dec != NULL) {
+		state = src->dec->state;
+		somfy_decoder_level_change(src->dec, new_level, len);
+		if (src->dec->state != state) {
+			event_add(&src->events, src->time, SIG_STATE,
+					src->dec->state);
+		}
+	}
+}
+
+static void source_init(struct source *src, int sig, struct somfy_decoder *dec)
+{
+	src->sig = sig;
+	src->time = 0;
+	edge_scan_init(&src->es, source_edge_cb, src);
+	src->events.ev = NULL;
+	src->events.len = 0;
+	src->events.size = 0;
+	src->dec = dec;
+}
+
+static void wave_flush(struct wave_out *out)
+{
+	if (fwrite(out->buf, 1, out->len, stdout) != out->len) {
+		perror("Failed writing output");
+		exit(EXIT_FAILURE);
+	}
+	out->len = 0;
+}
+
+/* Append value change of a signal, time must not decrease */
+static void wave_change(struct wave_out *out, uint64_t time, int sig, int val)
+{
+	char digits[20];
+	char *p;
+	int n = 0;
+	int i;
+	uint64_t t = time;
+
+#ifdef WITH_FST
+	if (out->fst != NULL) {
+		char bits[8];
+
+		if (!out->have_time || time != out->last_time) {
+			fstWriterEmitTimeChange(out->fst, time * out->time_mult);
+			out->last_time = time;
+			out->have_time = true;
+		}
+		for (i = 0; i < signals[sig].width; i++) {
+			bits[i] = '0' + ((val >> (signals[sig].width - 1 - i)) & 1);
+		}
+		bits[i] = '\0';
+		fstWriterEmitValueChange(out->fst, out->handles[sig], bits);
+		return;
+	}
+#endif
+
+	if (out->len + MAX_CHANGE_LEN > sizeof(out->buf))
+		wave_flush(out);
+
+	p = &out->buf[out->len];
+	if (!out->have_time || time != out->last_time) {
+		do {
+			digits[n++] = '0' + t % 10;
+			t /= 10;
+		} while (t != 0);
+
+		*p++ = '#';
+		while (n > 0)
+			*p++ = digits[--n];
+		*p++ = '\n';
+		out->last_time = time;
+		out->have_time = true;
+	}
+	if (signals[sig].width == 1) {
+		*p++ = '0' + val;
+	} else {
+		*p++ = 'b';
+		for (i = signals[sig].width - 1; i >= 0; i--) {
+			*p++ = '0' + ((val >> i) & 1);
+		}
+		*p++ = ' ';
+	}
+	*p++ = signals[sig].id;
+	*p++ = '\n';
+	out->len = p - out->buf;
+}
+
+/* Write the events of all sources in time order */
+static void wave_events(struct wave_out *out, struct source **srcs, int nsrcs)
+{
+	size_t pos[2] = { 0, 0 };
+	const struct event *ev;
+	int i, next;
+
+	for (;;) {
+		next = -1;
+		for (i = 0; i < nsrcs; i++) {
+			if (pos[i] == srcs[i]->events.len)
+				continue;
+			if (next == -1 || srcs[i]->events.ev[pos[i]].time <
+					srcs[next]->events.ev[pos[next]].time)
+				next = i;
+		}
+		if (next == -1)
+			break;
+
+		ev = &srcs[next]->events.ev[pos[next]++];
+		wave_change(out, ev->time, ev->sig, ev->val);
+	}
+
+	for (i = 0; i < nsrcs; i++) {
+		srcs[i]->events.len = 0;
+	}
+}
+
+static void wave_begin(struct wave_out *out, const char *fst_file,
+			unsigned long ts_val, int ts_unit, const char *date)
 {
-	int i, j;
-	int sample=0;
-	int val, last_val=0;
-	size_t len=0;
-	unsigned char buf[1024];
+	int sig;
+
+	out->have_time = false;
+	out->len = 0;
+
+#ifdef WITH_FST
+	out->fst = NULL;
+	if (fst_file != NULL) {
+		if ((out->fst = fstWriterCreate(fst_file, 1)) == NULL) {
+			fprintf(stderr, "Failed creating FST file %s\n", fst_file);
+			exit(EXIT_FAILURE);
+		}
+		// FST only supports powers of 10 as timescale
+		out->time_mult = ts_val;
+		fstWriterSetTimescale(out->fst, units[ts_unit].exponent);
+		fstWriterSetDate(out->fst, date);
+		fstWriterSetVersion(out->fst, "fx2_logger 0.1");
+		fstWriterSetScope(out->fst, FST_ST_VCD_MODULE, "fx2", NULL);
+		for (sig = 0; sig < NUM_SIGNALS; sig++) {
+			if (!out->enabled[sig])
+				continue;
+			out->handles[sig] = fstWriterCreateVar(out->fst,
+					signals[sig].width == 1 ?
+						FST_VT_VCD_WIRE : FST_VT_VCD_REG,
+					FST_VD_IMPLICIT, signals[sig].width,
+					signals[sig].name, 0);
+		}
+		fstWriterSetUpscope(out->fst);
+		return;
+	}
+#else
+	(void) fst_file;
+#endif
 
-	printf("$date Sat Aug 25 11:46:27 2012 $end\n");
+	printf("$date %s $end\n", date);
 	printf("$version fx2_logger 0.1 $end\n");
-	printf("$timescale 41667 ns $end\n");
+	printf("$timescale %lu %s $end\n", ts_val, units[ts_unit].name);
 	printf("$scope module fx2 $end\n");
-	printf("$var wire 1 ! 1 $end\n");
+	for (sig = 0; sig < NUM_SIGNALS; sig++) {
+		if (!out->enabled[sig])
+			continue;
+		printf("$var %s %d %c %s $end\n", signals[sig].type,
+				signals[sig].width, signals[sig].id,
+				signals[sig].name);
+	}
 	printf("$upscope $end\n");
 	printf("$enddefinitions $end\n");
 	printf("$dumpvars\n");
+}
 
-	while ((len = fread(buf, 1, sizeof(buf), stdin)) > 0) {
-		for (i=0; i<len; i++) {
-			for (j=0; j < 8; j++) {
-				if ((buf[i] << j) & 0x80) {
-					val = 1;
-				} else {
-					val = 0;
-				}
-				if (val != last_val || sample == 0) {
-					printf("#%u\n%u!\n", sample, val);
-				}
-				last_val = val;
-				sample++;
-			}
-		}
+static void wave_end(struct wave_out *out)
+{
+#ifdef WITH_FST
+	if (out->fst != NULL) {
+		fstWriterClose(out->fst);
+		return;
 	}
+#endif
+	wave_flush(out);
 	printf("$dumpoff\n");
 	printf("$end\n");
+}
+
+/*
+ * Parse timescale, a number followed by an optional space and a time unit
+ */
+static int parse_timescale(const char *str, unsigned long *val, int *unit)
+{
+	char *end;
+	int i;
+
+	if (!isdigit((unsigned char) str[0]))
+		return -1;
+	*val = strtoul(str, &end, 10);
+	if (*val == 0)
+		return -1;
+	if (*end == ' ')
+		end++;
+	for (i = 0; units[i].name != NULL; i++) {
+		if (strcmp(end, units[i].name) == 0) {
+			*unit = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void usage(char *my_name) {
+	fprintf(stderr, "Convert bit stream to VCD file\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s [-els] [-b <size>] [-L <depth>:<low>[:<high>]] [-T <timescale>]", my_name);
+#ifdef WITH_FST
+	fprintf(stderr, " [-F <file>]");
+#endif
+	fprintf(stderr, " < in.dat > out.vcd\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, " -b <size>        Read input in blocks of given size\n");
+	fprintf(stderr, " -e               Input is an edge stream instead of a bit stream\n");
+	fprintf(stderr, " -l               Add low-pass filtered bit stream\n");
+	fprintf(stderr, " -L <depth>:<low>[:<high>]\n");
+	fprintf(stderr, "                  Low-pass filter window size in bits, and number of set bits\n");
+	fprintf(stderr, "                  at or below which the level goes to 0 and at or above which\n");
+	fprintf(stderr, "                  it goes to 1, implies -l (default: %d:%d:%d, high defaults to\n",
+			LPF_DEPTH, LPF_LOW, LPF_HIGH);
+	fprintf(stderr, "                  depth - low)\n");
+	fprintf(stderr, " -s               Add Somfy decoder state\n");
+	fprintf(stderr, " -T, --timescale <timescale>\n");
+	fprintf(stderr, "                  Duration of one sample, eg. '1 us' or 100ns (default: %s)\n", TIMESCALE);
+#ifdef WITH_FST
+	fprintf(stderr, " -F <file>        Write FST file instead of VCD to stdout\n");
+#endif
+	fprintf(stderr, " -h               Display this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	ssize_t len=0;
+	size_t nbits;
+	const unsigned char *buf;
+	uint64_t *words;
+	uint64_t *filtered;
+	struct input in;
+	size_t block_size = 0;
+	const char *timescale = NULL;
+	const char *fst_file = NULL;
+	unsigned long ts_val;
+	int ts_unit;
+	char rate_ts[32];
+	char date[64];
+	time_t now;
+	struct wave_out *out;
+	struct source raw, lpf_src;
+	struct source *srcs[2];
+	int nsrcs;
+	struct lpf lpf;
+	struct somfy_classifier cls;
+	struct somfy_decoder dec;
+	bool with_lpf = false;
+	int lpf_depth = LPF_DEPTH;
+	int lpf_low = LPF_LOW;
+	int lpf_high = LPF_HIGH;
+	bool with_state = false;
+	int started = 0;
+	int edge_input = 0;
+	struct edge_reader reader;
+	struct edge_stream_header hdr = { 0, 0 };
+	int level, last_level = 0;
+	uint64_t duration;
+	uint64_t pending = 0;
+	int ret;
+
+	static const struct option long_options[] = {
+		{ "timescale", required_argument, NULL, 'T' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((opt = getopt_long(argc, argv, "b:elL:sT:F:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'b':
+			block_size = strtol(optarg, NULL, 0);
+			break;
+		case 'e':
+			edge_input = 1;
+			break;
+		case 'l':
+			with_lpf = true;
+			break;
+		case 'L':
+			ret = sscanf(optarg, "%d:%d:%d", &lpf_depth, &lpf_low,
+					&lpf_high);
+			if (ret == 2) {
+				lpf_high = lpf_depth - lpf_low;
+			} else if (ret != 3) {
+				fprintf(stderr, "Invalid low-pass filter parameters: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			with_lpf = true;
+			break;
+		case 's':
+			with_state = true;
+			break;
+		case 'T':
+			timescale = optarg;
+			break;
+		case 'F':
+#ifdef WITH_FST
+			fst_file = optarg;
+			break;
+#else
+			fprintf(stderr, "Compiled without FST support\n");
+			exit(EXIT_FAILURE);
+#endif
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default: /* '?' */
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (edge_input && with_lpf) {
+		fprintf(stderr, "Low-pass filter can't be used with edge stream input\n");
+		exit(EXIT_FAILURE);
+	}
+	if (lpf_init(&lpf, lpf_depth, lpf_low, lpf_high) != 0) {
+		fprintf(stderr, "Low-pass filter depth must be 1 to %d bits, "
+				"and 0 <= low < high <= depth\n",
+				LPF_MAX_DEPTH);
+		exit(EXIT_FAILURE);
+	}
+
+	if (input_open(&in, NULL, block_size) != 0) {
+		perror("Failed opening input");
+		exit(EXIT_FAILURE);
+	}
+
+	if (edge_input) {
+		if (edge_reader_init(&reader, &in, &hdr) != 0) {
+			perror("Failed reading edge stream header");
+			exit(EXIT_FAILURE);
+		}
+		if (timescale == NULL && hdr.sample_rate != 0) {
+			snprintf(rate_ts, sizeof(rate_ts), "%u ns",
+				(unsigned int) ((1000000000ULL + hdr.sample_rate / 2)
+						/ hdr.sample_rate));
+			timescale = rate_ts;
+		}
+	}
+	if (timescale == NULL) {
+		timescale = TIMESCALE;
+	}
+	if (parse_timescale(timescale, &ts_val, &ts_unit) != 0) {
+		fprintf(stderr, "Invalid timescale: %s\n", timescale);
+		exit(EXIT_FAILURE);
+	}
+
+	out = malloc(sizeof(*out));
+	words = malloc(((in.block_size + 7) / 8) * sizeof(uint64_t));
+	filtered = malloc(((in.block_size + 7) / 8) * sizeof(uint64_t));
+	if (out == NULL || words == NULL || filtered == NULL) {
+		perror("Failed allocating buffers");
+		exit(EXIT_FAILURE);
+	}
+
+	if (somfy_classifier_init(&cls, hdr.sample_rate != 0 ? hdr.sample_rate :
+					SOMFY_SAMPLE_RATE, SOMFY_SYMBOL_TIME) != 0) {
+		perror("Failed building pulse classifier");
+		exit(EXIT_FAILURE);
+	}
+	somfy_decoder_init(&dec, &cls, NULL, NULL);
+	source_init(&raw, SIG_RAW, (with_state && !with_lpf) ? &dec : NULL);
+	source_init(&lpf_src, SIG_LPF, with_state ? &dec : NULL);
+	nsrcs = 0;
+	srcs[nsrcs++] = &raw;
+	if (with_lpf) {
+		srcs[nsrcs++] = &lpf_src;
+	}
+
+	out->enabled[SIG_RAW] = true;
+	out->enabled[SIG_LPF] = with_lpf;
+	out->enabled[SIG_STATE] = with_state;
+
+	now = time(NULL);
+	if (hdr.start_time != 0) {
+		now = hdr.start_time / 1000000;
+	}
+	strftime(date, sizeof(date), "%a %b %e %H:%M:%S %Y", localtime(&now));
+
+	wave_begin(out, fst_file, ts_val, ts_unit, date);
+
+	if (edge_input) {
+		// Every record starts with a level change, except the first
+		while ((ret = edge_reader_next(&reader, &level, &duration)) > 0) {
+			if (!started) {
+				wave_change(out, 0, SIG_RAW, level);
+				if (with_state)
+					wave_change(out, 0, SIG_STATE, dec.state);
+				started = 1;
+			} else if (level != last_level) {
+				source_edge_cb(&raw, level, pending);
+				pending = 0;
+			}
+			last_level = level;
+			pending += duration;
+
+			if (raw.events.len >= MAX_EVENTS)
+				wave_events(out, srcs, nsrcs);
+		}
+		if (ret < 0) {
+			perror("Failed reading input");
+			exit(EXIT_FAILURE);
+		}
+		wave_events(out, srcs, nsrcs);
+	}
+
+	while (!edge_input && (len = input_read(&in, &buf)) > 0) {
+		nbits = edge_scan_load_bytes(buf, len, words);
+		if (!started) {
+			// Initial values; scan for changes from there
+			raw.es.level = words[0] >> 63;
+			wave_change(out, 0, SIG_RAW, raw.es.level);
+			if (with_lpf)
+				wave_change(out, 0, SIG_LPF, lpf.level);
+			if (with_state)
+				wave_change(out, 0, SIG_STATE, dec.state);
+			started = 1;
+		}
+		edge_scan_push(&raw.es, words, nbits);
+		if (with_lpf) {
+			memcpy(filtered, words, ((nbits + 63) / 64) * sizeof(uint64_t));
+			lpf_filter(&lpf, filtered, nbits);
+			edge_scan_push(&lpf_src.es, filtered, nbits);
+		}
+		wave_events(out, srcs, nsrcs);
+	}
+	if (len < 0) {
+		perror("Failed reading input");
+		exit(EXIT_FAILURE);
+	}
+	wave_end(out);
+
+	free(raw.events.ev);
+	free(lpf_src.events.ev);
+	free(filtered);
+	free(words);
+	free(out);
+	input_close(&in);
+	somfy_classifier_free(&cls);
 
 	return 0;
 }
@@ -3,9 +3,18 @@
  *
  * Convert a 1-bit per byte bit stream, as outputed by GnuRadio, to a packed bit
  * stream.  The output is a byte stream with 8 bits packed into one byte with
- * the MSB the first byte and the LSB the last.
+ * the MSB the first byte and the LSB the last. If the number of input bytes
+ * isn't a multiple of 8 the last output byte is padded with zero bits.
  *
- * Usage: ./pack_bit_stream < in.gdat > out.dat
+ * Packing is done 16 or 32 input bytes at a time with SSE2 or AVX2, when the
+ * CPU supports it, by shifting bit 0 of every byte into bit 7 and gathering
+ * the bytes' top bits with pmovmskb.
+ *
+ * With -u the conversion is reversed, every input bit is written as one byte
+ * with value 0 or 1. This gives the same output as am_to_ook -u, except for
+ * the padding bits of the last byte.
+ *
+ * Usage: ./pack_bit_stream [-u] [-b <size>] < in.gdat > out.dat
  *
  * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
  * All rights reserved.
@@ -34,33 +43,226 @@
  */
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+#include "input.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_SIMD
+# include <immintrin.h>
+#endif
+
+/*
+ * Pack kernels
+ *
+ * Pack bit 0 of n input bytes into n / 8 output bytes, first input byte in the
+ * MSB. n must be a multiple of 8.
+ */
+typedef void (*pack_fn_t)(const uint8_t *in, size_t n, uint8_t *out);
+
+static void pack_scalar(const uint8_t *in, size_t n, uint8_t *out)
+{
+	size_t i, k;
+	uint8_t b;
+
+	for (i = 0; i < n; i += 8) {
+		b = 0;
+		for (k = 0; k < 8; k++) {
+			b = (b << 1) | (in[i + k] & 0x01);
+		}
+		*out++ = b;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Reverse the bit order within every byte of a little endian movemask result,
+ * so that the first input byte ends up in the MSB of the first output byte
+ */
+static inline uint64_t mask_to_bytes(uint64_t m)
+{
+	m = ((m >> 1) & 0x5555555555555555ULL) | ((m & 0x5555555555555555ULL) << 1);
+	m = ((m >> 2) & 0x3333333333333333ULL) | ((m & 0x3333333333333333ULL) << 2);
+	m = ((m >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((m & 0x0f0f0f0f0f0f0f0fULL) << 4);
+	return m;
+}
+
+__attribute__((target("sse2")))
+static void pack_sse2(const uint8_t *in, size_t n, uint8_t *out)
+{
+	size_t i, k;
+	uint64_t m;
+
+	for (i = 0; i + 64 <= n; i += 64) {
+		m = 0;
+		for (k = 0; k < 64; k += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) &in[i + k]);
+			v = _mm_slli_epi16(v, 7);
+			m |= (uint64_t) (uint16_t) _mm_movemask_epi8(v) << k;
+		}
+		m = mask_to_bytes(m);
+		memcpy(&out[i / 8], &m, 8);
+	}
+	pack_scalar(&in[i], n - i, &out[i / 8]);
+}
+
+__attribute__((target("avx2")))
+static void pack_avx2(const uint8_t *in, size_t n, uint8_t *out)
+{
+	size_t i, k;
+	uint64_t m;
+
+	for (i = 0; i + 64 <= n; i += 64) {
+		m = 0;
+		for (k = 0; k < 64; k += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *) &in[i + k]);
+			v = _mm256_slli_epi16(v, 7);
+			m |= (uint64_t) (uint32_t) _mm256_movemask_epi8(v) << k;
+		}
+		m = mask_to_bytes(m);
+		memcpy(&out[i / 8], &m, 8);
+	}
+	pack_scalar(&in[i], n - i, &out[i / 8]);
+}
+#endif // HAVE_X86_SIMD
+
+static pack_fn_t pack_select(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return pack_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return pack_sse2;
+#endif
+	return pack_scalar;
+}
+
+/* Byte value to 8 bytes of 0/1, MSB first */
+static uint8_t unpack_table[256][8];
+
+static void unpack_init(void)
+{
+	int b, k;
+
+	for (b = 0; b < 256; b++) {
+		for (k = 0; k < 8; k++) {
+			unpack_table[b][k] = (b >> (7 - k)) & 0x01;
+		}
+	}
+}
+
+void usage(char *my_name) {
+	fprintf(stderr, "Convert 1-bit per byte stream to packed bit stream\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s [-u] [-b <size>] < in.gdat > out.dat\n", my_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, " -u         Unpack; convert packed bit stream to 1-bit per byte\n");
+	fprintf(stderr, " -b <size>  Read input in blocks of given size\n");
+	fprintf(stderr, " -h         Display this help\n");
+}
 
 int main(int argc, char *argv[])
 {
+	int opt;
 	int j;
 	uint8_t b;
-	size_t i;
-	size_t len=0;
-	unsigned char buf[1024];
+	ssize_t i;
+	ssize_t n;
+	ssize_t len=0;
+	size_t olen;
+	const uint8_t *buf;
+	uint8_t *obuf;
+	struct input in;
+	size_t block_size = 0;
+	bool unpack = false;
+	pack_fn_t pack_block = pack_select();
+
+	while ((opt = getopt(argc, argv, "ub:h")) != -1) {
+		switch (opt) {
+		case 'u':
+			unpack = true;
+			break;
+		case 'b':
+			block_size = strtol(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default: /* '?' */
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (input_open(&in, NULL, block_size) != 0) {
+		perror("Failed opening input");
+		exit(EXIT_FAILURE);
+	}
+
+	if (unpack) {
+		unpack_init();
+		obuf = malloc(in.block_size * 8);
+	} else {
+		obuf = malloc(in.block_size / 8 + 1);
+	}
+	if (obuf == NULL) {
+		perror("Failed allocating output buffer");
+		exit(EXIT_FAILURE);
+	}
 
 	j=0;
 	b=0;
-	while ((len = fread(buf, 1, sizeof(buf), stdin)) > 0) {
-		for (i=0; i<len; i++) {
-			b <<= 1;
-			b |= (buf[i] & 0x01);
-			if (++j == 8) {
-				fputc(b, stdout);
-				j = 0;
-				b = 0;
+	while ((len = input_read(&in, &buf)) > 0) {
+		olen = 0;
+		if (unpack) {
+			for (i=0; i<len; i++) {
+				memcpy(&obuf[olen], unpack_table[buf[i]], 8);
+				olen += 8;
+			}
+		} else {
+			// Complete a byte left over from the previous block
+			for (i=0; j != 0 && i<len; i++) {
+				b <<= 1;
+				b |= (buf[i] & 0x01);
+				if (++j == 8) {
+					obuf[olen++] = b;
+					j = 0;
+					b = 0;
+				}
+			}
+
+			n = (len - i) & ~7;
+			pack_block(&buf[i], n, &obuf[olen]);
+			olen += n / 8;
+
+			for (i += n; i<len; i++) {
+				b <<= 1;
+				b |= (buf[i] & 0x01);
+				j++;
 			}
 		}
+		if (fwrite(obuf, 1, olen, stdout) != olen) {
+			perror("Failed writing output");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (len < 0) {
+		perror("Failed reading input");
+		exit(EXIT_FAILURE);
 	}
 
-	if (j < 8) {
+	if (j != 0) {
 		b <<= (8-j);
 		fputc(b, stdout);
 	}
 
+	free(obuf);
+	input_close(&in);
+
 	return 0;
 }
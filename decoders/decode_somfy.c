@@ -3,12 +3,37 @@
  *
  * This tool decodes the Somfy RTS packets from a raw bit stream. The bit
  * stream is what comes out of the OOK demodulator and should be sampled 36 us
- * per sample. The samples are packed into a byte with the MSB the first bit
- * and the LSB the last.
+ * per sample, or at the rate given with -s. The samples are packed into a byte
+ * with the MSB the first bit and the LSB the last. Alternatively an edge
+ * stream, as written by am_to_ook -e, can be used as input.
  *
  * The Addresses of the remotes can be resolved to human readable names. This
- * is done by creating a file called 'remotes.txt' in the current directory.
- * The file should contain a hexadecimal remote address followed by the name.
+ * is done by creating a file called 'remotes.txt' in the current directory, or
+ * passing an other file with the '-r' option. Every line of the file should
+ * contain a hexadecimal remote address followed by the name. The file is
+ * reloaded whenever it changes, without interrupting the decoding.
+ *
+ * Remotes send every frame a number of times. With -u these copies are printed
+ * as one frame with a repeat count, and a warning is added when the rolling
+ * code of a remote doesn't increase. Frames are then printed when no more
+ * copies are received for half a second of signal time, or of wall clock time
+ * in low latency mode.
+ *
+ * Every frame is tagged with the sample index of the start of its preamble and
+ * of its last level change. If the time of the first input sample is known,
+ * from -E or the edge stream header, the frame time is derived from the start
+ * sample instead of the time the frame was decoded.
+ *
+ * For live input -i keeps the delay between receiving a frame and printing
+ * it low. Input is processed as soon as it arrives instead of in whole blocks,
+ * and the output is flushed after every frame, unless -F or -W say otherwise.
+ * Under load whole blocks are read and written as usual.
+ *
+ * Multiple streams can be decoded by one process by passing the input files or
+ * FIFOs as arguments instead of using stdin. Every input has its own decoder
+ * and is read when data is available. Frames are prefixed with the input name.
+ * The name lookup and output formatting is done by a pool of worker threads
+ * (-j), frames of the same input are always printed in order.
  *
  * Usage:
  * ------
@@ -58,38 +83,77 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "edge_scan.h"
+#include "edge_stream.h"
+#include "input.h"
+#include "lpf.h"
+#include "somfy.h"
+#include "somfy_hosts.h"
+#include "somfy_output.h"
+#include "somfy_track.h"
+
+#define REMOTES_FILE "remotes.txt"
+// Frames queued per worker in multi-channel mode
+#define MATCH_QUEUE_LEN 64
+// Maximum time between checks for expired events in multi-channel mode
+#define EXPIRE_INTERVAL_MS 100
 
 int verbose = 0;
-int one_line = 0;
 int numeric = 0;
-
-int data_len;
-uint64_t data;
-uint64_t data2;
-unsigned int key2=0x11;
-enum state_t { idle, preamble, data0, data1 } state = idle, new_state;
-// idle -> preamble: new_level = 0 & len == 68 ~10%
-// preamble -> data0: new_level = 0 & len == 130 ~5%
-// preamble -> idle: len != 68 ~10%
-// data0 -> data1: new_level = 0 & len == 17.5 ~10%
-// data0 -> data0: new_level = 0 & len == 34.5 ~10%
-// data1 -> data0: new_level = 0 & len == 17.5 ~10%
-// data0 -> idle: else
-// data1 -> idle: else
-
-typedef uint64_t somfy_frame_t;
+struct somfy_output output;
+uint32_t sample_rate = 0;
+uint32_t symbol_time = SOMFY_SYMBOL_TIME;
+bool use_lpf = false;
+int lpf_depth = LPF_DEPTH;
+int lpf_low = LPF_LOW;
+int lpf_high = LPF_HIGH;
+bool track = false;
+bool low_latency = false;
+// Time of the first input sample in microseconds since the Unix epoch, 0 if
+// unknown
+uint64_t start_time = 0;
 
 void usage(char *my_name) {
-	fprintf(stderr, "Usage: %s [-1nvh]\n", my_name);
+	fprintf(stderr, "Usage: %s [-1eilnuvh] [-b <size>] [-E <time>] [-o <format>] [-F <frames>] [-W <ms>] [-L <depth>:<low>[:<high>]] [-j <threads>] [-r <file>] [-s <rate>] [-S <us>] [<input>...]\n", my_name);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Options:\n");
-	fprintf(stderr, " -1    Use single line output mode\n");
-	fprintf(stderr, " -n    Don't display human readable control and address names\n");
-	fprintf(stderr, " -v    Increase verbose level, can be used multiple times\n");
-	fprintf(stderr, " -h    Display this help\n");
+	fprintf(stderr, " -1         Use single line output mode, same as -o oneline\n");
+	fprintf(stderr, " -o <format>  Output format: long, oneline, json or binary (default: long)\n");
+	fprintf(stderr, " -F <frames>  Flush output after this many frames (default: 1 if output is a\n");
+	fprintf(stderr, "            terminal, else no limit)\n");
+	fprintf(stderr, " -W <ms>    Flush output when a frame has waited this long, 0 for no limit\n");
+	fprintf(stderr, "            (default: %d)\n", SOMFY_OUTPUT_DELAY / 1000);
+	fprintf(stderr, " -b <size>  Read input in blocks of given size\n");
+	fprintf(stderr, " -e         Input is an edge stream instead of a bit stream\n");
+	fprintf(stderr, " -E <time>  Time of the first input sample in seconds since the Unix epoch,\n");
+	fprintf(stderr, "            or 'now' (default: from edge stream header, else unknown)\n");
+	fprintf(stderr, " -i         Low latency mode, process input as soon as it arrives and\n");
+	fprintf(stderr, "            flush output after every frame\n");
+	fprintf(stderr, " -j <threads>  Number of threads resolving and printing frames when\n");
+	fprintf(stderr, "            decoding multiple inputs (default: 1)\n");
+	fprintf(stderr, " -l         Low-pass filter input to remove glitches\n");
+	fprintf(stderr, " -L <depth>:<low>[:<high>]\n");
+	fprintf(stderr, "            Low-pass filter window size in bits, and number of set bits at\n");
+	fprintf(stderr, "            or below which the level goes to 0 and at or above which it goes\n");
+	fprintf(stderr, "            to 1, implies -l (default: %d:%d:%d, high defaults to depth - low)\n",
+			LPF_DEPTH, LPF_LOW, LPF_HIGH);
+	fprintf(stderr, " -n         Don't display human readable control and address names\n");
+	fprintf(stderr, " -r <file>  Read remote names from file (default: %s)\n", REMOTES_FILE);
+	fprintf(stderr, " -u         Print repeated frames once, with the number of repeats, and warn\n");
+	fprintf(stderr, "            about rolling codes that don't increase\n");
+	fprintf(stderr, " -s <rate>  Sample rate of input in Hz (default: from edge stream header, or\n");
+	fprintf(stderr, "            %u)\n", SOMFY_SAMPLE_RATE);
+	fprintf(stderr, " -S <us>    Symbol time in microseconds (default: %u)\n", SOMFY_SYMBOL_TIME);
+	fprintf(stderr, " -v         Increase verbose level, can be used multiple times\n");
+	fprintf(stderr, " -h         Display this help\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "This program expects the raw bit stream form the OOK demodulator as input on\n");
 	fprintf(stderr, "stdin. For example when using RTL-SDR the following command line can be used:\n");
@@ -97,321 +161,546 @@ void usage(char *my_name) {
 	fprintf(stderr, "  ./converters/am_to_ook -d 10 -t 1500 -  | \\\n");
 	fprintf(stderr, "  ./decoders/decode_somfy\n");
 	fprintf(stderr, "Note that the rtl_fm gain and am_to_ook threshold values will need tweaking\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "If input files or FIFOs are given, all of them are decoded at the same time.\n");
 }
 
-uint8_t somfy_frame_get_encryption_key(somfy_frame_t frame) {
-	return (frame >> (6*8)) & 0xFF;
+/* Terminate text output and flush */
+static void finish_output(void)
+{
+	if (output.format == SOMFY_OUTPUT_LONG ||
+	    output.format == SOMFY_OUTPUT_ONELINE) {
+		putchar('\n');
+	}
+	if (somfy_output_close(&output) != 0) {
+		perror("Failed writing output");
+		exit(EXIT_FAILURE);
+	}
 }
 
-uint8_t somfy_frame_get_control(somfy_frame_t frame) {
-	return (frame >> (5*8 + 4)) & 0xF;
+void level_change_cb(void *arg, int new_level, uint64_t len)
+{
+	somfy_decoder_level_change((struct somfy_decoder *) arg, new_level, len);
 }
 
-uint8_t somfy_frame_get_chksum(somfy_frame_t frame) {
-	return (frame >> (5*8)) & 0xF;
+/* Decode bits, reporting a frame as soon as the gap after it is seen */
+static void scan_bits(struct edge_scan *es, struct somfy_decoder *dec,
+			const uint64_t *words, size_t nbits)
+{
+	edge_scan_push(es, words, nbits);
+	somfy_decoder_idle(dec, es->level, es->sample - es->last_change);
 }
 
-uint16_t somfy_frame_get_rolling_code(somfy_frame_t frame) {
-	return (frame >> (3*8)) & 0xFFFF;
-}
+/* Milliseconds until events must be expired or output flushed, or -1 */
+static int poll_timeout(void)
+{
+	int timeout = track ? EXPIRE_INTERVAL_MS : -1;
 
-uint32_t somfy_frame_get_addr(somfy_frame_t frame) {
-	return ((frame & 0xFF) << 16) | (frame & 0xFF00) | ((frame & 0xFF0000) >> 16);
+	if (output.flush_delay != 0 &&
+	    (timeout == -1 || output.flush_delay / 1000 < (uint64_t) timeout)) {
+		timeout = output.flush_delay / 1000 + 1;
+	}
+	return timeout;
 }
 
-uint8_t somfy_calc_checksum(somfy_frame_t frame) {
-	int checksum=0;
-	int i;
-	for (i=0; i < 14; i++) {
-		checksum ^= frame & 0xf;
-		frame = frame >> 4;
+/* Expire tracked events and flush output when due */
+static void periodic(struct somfy_source *src, const struct somfy_decoder *dec)
+{
+	somfy_source_expire(src, dec);
+	if (somfy_output_poll(&output) != 0) {
+		perror("Failed writing output");
+		exit(EXIT_FAILURE);
 	}
-
-	return checksum;
 }
 
-const char *somfy_frame_get_control_name(somfy_frame_t frame) {
-	static const char *names[16] = {
-		"c0",
-		"MY",
-		"UP",
-		"MY+UP",
-		"DOWN",
-		"MY+DOWN",
-		"UP+DOWN",
-		"c7",
-		"PROG",
-		"SUN+FLAG",
-		"FLAG",
-		"c11",
-		"c12",
-		"c13",
-		"c14",
-		"c15"
-	};
-	
-	return names[somfy_frame_get_control(frame)];
+/*
+ * Get sample rate to decode input at
+ *
+ * The rate given with -s is used if any, else the rate from the edge stream
+ * header if known. hdr_rate is 0 for bit streams.
+ */
+static uint32_t decode_rate(const char *name, uint32_t hdr_rate)
+{
+	if (sample_rate == 0) {
+		return hdr_rate != 0 ? hdr_rate : SOMFY_SAMPLE_RATE;
+	}
+	if (hdr_rate != 0 &&
+	    (hdr_rate < sample_rate * 9 / 10 ||
+	     hdr_rate > sample_rate * 11 / 10))
+	{
+		fprintf(stderr, "Warning: %s: edge stream sample rate %u Hz, "
+				"expected %u Hz\n", name, hdr_rate,
+				sample_rate);
+	}
+	return sample_rate;
 }
 
-
-/************** address resolving ********************/
-typedef struct somfy_host_cache_entry {
-	uint32_t addr;
-	char *name;
-	struct somfy_host_cache_entry *next;
-} somfy_hosts_cache_t;
-
-somfy_hosts_cache_t *somfy_hosts_cache = NULL;
-
-void somfy_hosts_cache_init(const char *cache_file)
+static void classifier_init(struct somfy_classifier *cls, uint32_t rate)
 {
-	FILE *ifp;
-	char *line = NULL;
-	size_t len = 0;
-	ssize_t bytes_read;
-
-	if ((ifp = fopen(cache_file, "r")) == NULL) {
-		return;
+	if (somfy_classifier_init(cls, rate, symbol_time) != 0) {
+		perror("Failed building pulse classifier");
+		exit(EXIT_FAILURE);
 	}
+}
 
-	while ((bytes_read = getline(&line, &len, ifp)) != -1) {
-		char *sp;
-
-		// trim '\n', '\r' and other space from the end of the line
-		while (bytes_read > 0 && isspace(line[bytes_read - 1])) {
-			line[bytes_read - 1] = '\0';
-			bytes_read--;
+/*
+ * Multi-channel decoding
+ *
+ * The main thread waits for input on all channels with epoll and runs the
+ * decoders. Received frames are queued to a worker thread, which resolves the
+ * names and writes the frame to stdout. Every channel always uses the same
+ * worker, so its frames stay in order. Regular files can't be polled, these
+ * are read once every loop, without waiting.
+ */
+struct match_job {
+	const struct channel *ch;
+	struct somfy_event ev;
+};
+
+struct match_worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	struct match_job jobs[MATCH_QUEUE_LEN];
+	size_t head;
+	size_t count;
+	bool closing;
+};
+
+struct channel {
+	const char *name;
+	uint32_t index;
+	int fd;
+	bool polled;
+	bool open;
+
+	struct somfy_decoder dec;
+	struct edge_scan es;
+	struct edge_parser parser;
+	// Classifier for edge streams with an other sample rate
+	struct somfy_classifier own_cls;
+	bool own_cls_used;
+	struct lpf lpf;
+	struct somfy_source src;
+	struct match_worker *worker;
+};
+
+static void *match_worker_main(void *arg)
+{
+	struct match_worker *w = (struct match_worker *) arg;
+	struct match_job job;
+	char *obuf;
+	size_t olen;
+	FILE *ofp;
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		while (w->count == 0 && ! w->closing) {
+			pthread_cond_wait(&w->cond, &w->lock);
 		}
-
-		if (bytes_read < 8)
-			continue;
-
-		somfy_hosts_cache_t *entry = (somfy_hosts_cache_t *) malloc(sizeof(somfy_hosts_cache_t));
-
-		// addr
-		entry->addr = strtol(line, &sp, 16);
-		if (sp != &(line[6]) || !isspace(*sp)) {
-			free(entry);
+		if (w->count == 0) {
+			pthread_mutex_unlock(&w->lock);
+			return NULL;
+		}
+		job = w->jobs[w->head];
+		w->head = (w->head + 1) % MATCH_QUEUE_LEN;
+		w->count--;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+
+		// Format the whole frame first, so frames don't get mixed up
+		if ((ofp = open_memstream(&obuf, &olen)) == NULL) {
+			perror("Failed formatting frame");
 			continue;
 		}
+		somfy_output_format(&output, ofp, &job.ev, job.ch->name,
+					job.ch->index);
+		fclose(ofp);
 
-		// delim
-		while (isspace(*sp)) {
-			sp++;
-		}
-		if (strlen(sp) == 0) {
-			free(entry);
-			continue;
+		if (somfy_output_write_raw(&output, obuf, olen) != 0) {
+			perror("Failed writing output");
+			exit(EXIT_FAILURE);
 		}
+		free(obuf);
+	}
+}
 
-		// name
-		entry->name = strdup(sp);
+static void queue_event(void *arg, const struct somfy_event *ev)
+{
+	const struct channel *ch = (const struct channel *) arg;
+	struct match_worker *w = ch->worker;
 
-		entry->next = somfy_hosts_cache;
-		somfy_hosts_cache = entry;
+	pthread_mutex_lock(&w->lock);
+	while (w->count == MATCH_QUEUE_LEN) {
+		pthread_cond_wait(&w->cond, &w->lock);
 	}
+	w->jobs[(w->head + w->count) % MATCH_QUEUE_LEN].ch = ch;
+	w->jobs[(w->head + w->count) % MATCH_QUEUE_LEN].ev = *ev;
+	w->count++;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
 
-	free(line);
-
+static void edge_record_cb(void *arg, int level, uint64_t duration)
+{
+	// Every record ends with a level change
+	level_change_cb(arg, !level, duration);
 }
 
-#define ESAN_NONAME -1
-int somfy_addr_to_name(uint32_t addr, char *dst, size_t len)
+static void channel_close(struct channel *ch, int epfd)
 {
-	somfy_hosts_cache_t *entry = somfy_hosts_cache;
-	while (entry != NULL && entry->name != NULL) {
-		if (entry->addr == addr) {
-			strncpy(dst, entry->name, len);
-			dst[len-1] = '\0';
-			return 0;
-		}
-		entry = entry->next;
+	if (ch->polled) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, ch->fd, NULL);
 	}
-
-	return ESAN_NONAME;
+	if (ch->fd != STDIN_FILENO) {
+		close(ch->fd);
+	}
+	if (ch->own_cls_used) {
+		somfy_classifier_free(&ch->own_cls);
+	}
+	somfy_source_close(&ch->src);
+	ch->open = false;
 }
 
-void print_frame_long(uint64_t frame)
+/*
+ * Read and decode available input of channel
+ *
+ * Returns false if the channel reached the end of its input or failed.
+ */
+static bool channel_read(struct channel *ch, int edge_input, uint8_t *buf,
+				size_t block_size, uint64_t *words)
 {
-	uint8_t checksum = 0;
-
-	printf("%.14jx:\n", (uintmax_t) frame);
-
-	checksum = somfy_calc_checksum(frame);
-	if (checksum == 0) {
-		uint32_t addr;
-		char addr_str[1024];
+	ssize_t len;
+	size_t nbits;
+	size_t hlen = 0;
+	uint32_t rate;
+
+	if ((len = read(ch->fd, buf, block_size)) < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
+		fprintf(stderr, "Failed reading %s: %s\n", ch->name,
+				strerror(errno));
+		return false;
+	}
 
-		printf("checksum = OK\n");
-		printf("Encryption Key = %.2x\n", somfy_frame_get_encryption_key(frame));
-		printf("Control=%.2x", somfy_frame_get_control(frame));
-		if (! numeric) {
-			printf(" (%s)", somfy_frame_get_control_name(frame)); 
+	if (edge_input) {
+		if (len == 0) {
+			if (edge_parser_finish(&ch->parser) != 0) {
+				fprintf(stderr, "%s: truncated edge stream\n",
+						ch->name);
+			}
+			return false;
 		}
-		printf(", ");
-		printf("Rolling Code = %.4x\n", somfy_frame_get_rolling_code(frame));
-		
-		addr = somfy_frame_get_addr(frame);
-		printf("Address = %.6x", addr);
-		if (! numeric && somfy_addr_to_name(addr, addr_str, sizeof(addr_str)) == 0) {
-			printf(" (%s)", addr_str);
+		// Pick the classifier before any records are decoded
+		if (ch->parser.hdr_len < EDGE_STREAM_HEADER_SIZE) {
+			hlen = EDGE_STREAM_HEADER_SIZE - ch->parser.hdr_len;
+			if (hlen > (size_t) len)
+				hlen = len;
+			if (edge_parser_push(&ch->parser, buf, hlen,
+						edge_record_cb, &ch->dec) != 0)
+				goto invalid;
+			if (ch->parser.hdr_len < EDGE_STREAM_HEADER_SIZE)
+				return true;
+
+			rate = decode_rate(ch->name, ch->parser.hdr.sample_rate);
+			if (rate != decode_rate(ch->name, 0)) {
+				classifier_init(&ch->own_cls, rate);
+				ch->own_cls_used = true;
+				ch->dec.cls = &ch->own_cls;
+			}
+			ch->src.rate = rate;
+			if (ch->src.epoch == 0) {
+				ch->src.epoch = ch->parser.hdr.start_time;
+			}
 		}
-		putchar('\n');
-	} else {
-		printf("checksum = FAILED (%.2x)\n", checksum);
+		if (edge_parser_push(&ch->parser, buf + hlen, len - hlen,
+					edge_record_cb, &ch->dec) != 0)
+			goto invalid;
+		return true;
+	}
+
+	if (len == 0) {
+		edge_scan_flush(&ch->es);
+		return false;
+	}
+	nbits = edge_scan_load_bytes(buf, len, words);
+	if (use_lpf) {
+		lpf_filter(&ch->lpf, words, nbits);
 	}
-	printf("--------------------------------------------------------------------------------\n");
+	scan_bits(&ch->es, &ch->dec, words, nbits);
+	return true;
+
+invalid:
+	fprintf(stderr, "%s: not a valid edge stream\n", ch->name);
+	return false;
 }
 
-void print_frame_oneline(uint64_t frame)
+static int decode_multi(char *paths[], int nchannels, int edge_input,
+			size_t block_size, int nworkers)
 {
-	uint8_t checksum = 0;
+	struct channel *channels;
+	struct match_worker *workers;
+	struct somfy_classifier cls;
+	struct epoll_event *events;
+	uint8_t *buf;
+	uint64_t *words;
+	int epfd;
+	int nopen = 0;
+	int nunpolled = 0;
+	int nstarted;
+	int timeout;
+	int n;
+	int i;
+	int err;
+
+	if (block_size == 0)
+		block_size = INPUT_STREAM_BLOCK_SIZE;
+
+	channels = calloc(nchannels, sizeof(*channels));
+	workers = calloc(nworkers, sizeof(*workers));
+	events = calloc(nchannels, sizeof(*events));
+	buf = malloc(block_size);
+	words = malloc((block_size + 7) / 8 * sizeof(uint64_t));
+	if (channels == NULL || workers == NULL || events == NULL ||
+	    buf == NULL || words == NULL) {
+		perror("Failed allocating buffers");
+		exit(EXIT_FAILURE);
+	}
 
-	printf("%.14jx: ", (uintmax_t) frame);
+	classifier_init(&cls, decode_rate(NULL, 0));
 
-	checksum = somfy_calc_checksum(frame);
-	if (checksum == 0) {
-		uint32_t addr;
-		char addr_str[1024];
+	if ((epfd = epoll_create1(0)) == -1) {
+		perror("Failed creating epoll instance");
+		exit(EXIT_FAILURE);
+	}
 
-		printf("checksum=OK, ");
-		printf("Encryption Key=%.2x, ", somfy_frame_get_encryption_key(frame));
-		printf("Control=%.2x", somfy_frame_get_control(frame));
-		if (! numeric) {
-			printf("(%s)", somfy_frame_get_control_name(frame)); 
-		}
-		printf(", ");
-		printf("Rolling Code=%.4x, ", somfy_frame_get_rolling_code(frame));
-		
-		addr = somfy_frame_get_addr(frame);
-		printf("Address=%.6x", addr);
-		if (! numeric && somfy_addr_to_name(addr, addr_str, sizeof(addr_str)) == 0) {
-			printf("(%s)", addr_str);
+	for (nstarted = 0; nstarted < nworkers; nstarted++) {
+		struct match_worker *w = &workers[nstarted];
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		if ((err = pthread_create(&w->thread, NULL, match_worker_main,
+						w)) != 0) {
+			fprintf(stderr, "Failed starting worker thread: %s\n",
+					strerror(err));
+			exit(EXIT_FAILURE);
 		}
-		putchar('\n');
-	} else {
-		printf("checksum=FAILED(%.2x)\n", checksum);
 	}
-}
 
-void level_change_cb(int new_level, unsigned int len) 
-{
-	switch (state) {
-	case idle:
-		if (new_level == 0 && len >= 64 && len <= 72) {
-			new_state = preamble;
-		} else {
-			new_state = idle;
-		}
-		break;
-	case preamble:
-		if (new_level == 0 && len >= 127 && len <= 133) {
-			new_state = data0;
-		} else if (len >= 64 && len <= 72) {
-			new_state = preamble;
-		} else {
-			new_state = idle;
+	for (i = 0; i < nchannels; i++) {
+		struct channel *ch = &channels[i];
+		struct epoll_event ev;
+
+		ch->name = paths[i];
+		ch->index = i;
+		if (strcmp(paths[i], "-") == 0) {
+			ch->fd = STDIN_FILENO;
+			fcntl(ch->fd, F_SETFL, fcntl(ch->fd, F_GETFL) | O_NONBLOCK);
+		} else if ((ch->fd = open(paths[i], O_RDONLY | O_NONBLOCK)) == -1) {
+			fprintf(stderr, "Failed opening %s: %s\n", paths[i],
+					strerror(errno));
+			exit(EXIT_FAILURE);
 		}
-		break;
-	case data0:
-		if (len >= 30 && len <= 40) {
-			new_state = data0;
-		} else if (len >= 10 && len <= 25) {
-			new_state = data1;
+		ch->open = true;
+		nopen++;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = ch;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, ch->fd, &ev) == 0) {
+			ch->polled = true;
+		} else if (errno == EPERM) {
+			nunpolled++;
 		} else {
-			new_state = idle;
+			fprintf(stderr, "Failed polling %s: %s\n", paths[i],
+					strerror(errno));
+			exit(EXIT_FAILURE);
 		}
-		break;
-	case data1:
-		if (len >= 10 && len <= 25) {
-			new_state = data0;
-		} else {
-			new_state = idle;
+
+		ch->worker = &workers[i % nworkers];
+		if (somfy_source_init(&ch->src, decode_rate(NULL, 0), 1,
+					start_time, track, low_latency,
+					queue_event, ch) != 0) {
+			perror("Failed creating remote tracker");
+			exit(EXIT_FAILURE);
 		}
-		break;
+		somfy_decoder_init(&ch->dec, &cls, somfy_source_frame_cb,
+					&ch->src);
+		ch->dec.verbose = verbose;
+		edge_scan_init(&ch->es, level_change_cb, &ch->dec);
+		edge_parser_init(&ch->parser);
+		lpf_init(&ch->lpf, lpf_depth, lpf_low, lpf_high);
 	}
-	if ((state == data0 || state == data1) &&
-	    (new_state != data0 && new_state != data1))
-	{
-		if (data_len) {
-			if (verbose > 0) printf(", len=%u, dat=%jx\n", data_len, (uintmax_t) data);
-
-			if (data_len == 56) {
-				int j;
-				uint64_t m=0xff000000000000;
-
-				// Decrypt by for N=1..len: m[N] = c[N] ^ c[N-1]
-				data2=data;
-				for (j=0; j<6; j++) {
-					data = (data ^ ((data2 & m) >> 8));
-					m = m >> 8;
-				}
-
-				if (one_line) {
-					print_frame_oneline(data);
-				} else {
-					print_frame_long(data);
-				}
-			}
-		} else {
-			if (verbose > 0) putchar('\n');
+
+	while (nopen > 0) {
+		// Wake up in time to expire events and flush output
+		timeout = poll_timeout();
+		if (nunpolled > 0) {
+			timeout = 0;
 		}
-	}
-	if (state == preamble && new_state == data0) {
-		data_len = 0;
-		data = 0;
-		if (verbose > 0) printf("start: ");
-	}
-	if ((state == data0 || state == data1) && new_state == data0) {
-	/*
-		if (state == data1) {
-			printf("s %c\n", (new_level == 1) ? '^' : 'v');
-		} else {
-			printf("l %c\n", (new_level == 1) ? '^' : 'v');
+		n = epoll_wait(epfd, events, nchannels, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Failed waiting for input");
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < n; i++) {
+			struct channel *ch = (struct channel *) events[i].data.ptr;
+
+			if (! channel_read(ch, edge_input, buf, block_size, words)) {
+				channel_close(ch, epfd);
+				nopen--;
+			}
 		}
-	*/
-		data = (data << 1) | new_level;
-		data_len++;
-		if (verbose > 0) {
-			printf("%d", new_level); // rising edge == 1, faling edge == 0
-			if ((data_len % 8) == 0) {
-				printf(" ");
+
+		for (i = 0; i < nchannels && nunpolled > 0; i++) {
+			struct channel *ch = &channels[i];
+
+			if (! ch->open || ch->polled)
+				continue;
+			if (! channel_read(ch, edge_input, buf, block_size,
+						words)) {
+				channel_close(ch, epfd);
+				nopen--;
+				nunpolled--;
 			}
 		}
+
+		for (i = 0; i < nchannels; i++) {
+			somfy_source_expire(&channels[i].src,
+						&channels[i].dec);
+		}
+		if (somfy_output_poll(&output) != 0) {
+			perror("Failed writing output");
+			exit(EXIT_FAILURE);
+		}
 	}
-	// printf(" old: %d, new %d\n", state, new_state);
 
+	while (nstarted > 0) {
+		struct match_worker *w = &workers[--nstarted];
 
-	state = new_state;
-}
+		pthread_mutex_lock(&w->lock);
+		w->closing = true;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thread, NULL);
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+	}
 
-#define FILTER_DEPTH 8
-#define FILTER_TRESHOLD 2
+	close(epfd);
+	somfy_classifier_free(&cls);
+	free(words);
+	free(buf);
+	free(events);
+	free(workers);
+	free(channels);
+
+	finish_output();
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
 	int opt;
-	int i, j;
-	off_t sample=0;
-	int level=0;
-	int new_level=0;
-	off_t last_change=0;
-	size_t len=0;
-	unsigned char buf[1024];
-	unsigned int mask;
-#ifdef WITH_LPF
-	int one_cnt = 0;
-	int filter_bits = 0;
-#endif
-	
-	while ((opt = getopt(argc, argv, "1nvh")) != -1) {
+	const char *remotes_file = REMOTES_FILE;
+	ssize_t len=0;
+	size_t nbits;
+	const uint8_t *buf;
+	uint64_t *words;
+	struct input in;
+	size_t block_size = 0;
+	struct lpf lpf;
+	struct somfy_decoder dec;
+	struct edge_scan es;
+	int edge_input = 0;
+	struct edge_reader reader;
+	struct edge_stream_header hdr;
+	int level;
+	uint64_t duration;
+	int ret;
+	int nworkers = 1;
+	uint32_t rate;
+	struct somfy_classifier cls;
+	struct somfy_source src;
+	enum somfy_output_format format = SOMFY_OUTPUT_LONG;
+	unsigned int flush_frames = 0;
+	bool flush_frames_set = false;
+	uint64_t flush_delay = SOMFY_OUTPUT_DELAY;
+
+	while ((opt = getopt(argc, argv, "1b:eE:ij:lL:no:r:s:S:uvF:W:h")) != -1) {
 		switch (opt) {
 		case '1':
-			one_line = 1;
+			format = SOMFY_OUTPUT_ONELINE;
+			break;
+		case 'o':
+			if (somfy_output_parse_format(optarg, &format) != 0) {
+				fprintf(stderr, "Unknown output format: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'F':
+			flush_frames = strtoul(optarg, NULL, 0);
+			flush_frames_set = true;
+			break;
+		case 'W':
+			flush_delay = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'b':
+			block_size = strtol(optarg, NULL, 0);
+			break;
+		case 'e':
+			edge_input = 1;
+			break;
+		case 'E':
+			if (strcmp(optarg, "now") == 0) {
+				start_time = somfy_realtime_us();
+			} else {
+				start_time = strtod(optarg, NULL) * 1000000;
+			}
+			break;
+		case 'i':
+			low_latency = true;
+			break;
+		case 'j':
+			nworkers = strtol(optarg, NULL, 0);
+			if (nworkers <= 0) {
+				nworkers = 1;
+			}
+			break;
+		case 'l':
+			use_lpf = true;
+			break;
+		case 'L':
+			ret = sscanf(optarg, "%d:%d:%d", &lpf_depth, &lpf_low,
+					&lpf_high);
+			if (ret == 2) {
+				lpf_high = lpf_depth - lpf_low;
+			} else if (ret != 3) {
+				fprintf(stderr, "Invalid low-pass filter parameters: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			use_lpf = true;
 			break;
 		case 'n':
 			numeric = 1;
 			break;
+		case 'u':
+			track = true;
+			break;
+		case 'r':
+			remotes_file = optarg;
+			break;
+		case 's':
+			sample_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			symbol_time = strtoul(optarg, NULL, 0);
+			if (symbol_time == 0) {
+				symbol_time = SOMFY_SYMBOL_TIME;
+			}
+			break;
 		case 'v':
 			verbose++;
 			break;
@@ -424,50 +713,120 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	somfy_hosts_cache_init("remotes.txt");
-
-	while ((len = fread(buf, 1, sizeof(buf), stdin)) > 0) {
-		for (i=0; i<len; i++) {
-			mask=0x80;
-			for (j=0; j < 8; j++) {
-#ifdef WITH_LPF
-				if (filter_bits & (1 << FILTER_DEPTH)) {
-					one_cnt--;
-				}
-				filter_bits <<= 1;
-				if (((buf[i] & mask) != 0)) {
-					filter_bits |= 0x01;
-					one_cnt++;
-				}
-
-				if (level && one_cnt <= FILTER_TRESHOLD) {
-					new_level = 0;
-				} else if (! level && one_cnt >= (FILTER_DEPTH - FILTER_TRESHOLD)) {
-					new_level = 1;
-				} else {
-					new_level = level;
-				}
-#else
-				new_level = ((buf[i] & mask) != 0);
-#endif
-
-				if (new_level != level) {
-					off_t len = sample - last_change;
-
-//printf("@%ju %d->%d %ju\n", sample, !new_level, new_level, len);
-					level_change_cb(new_level, len);
-
-					level = new_level;
-					last_change = sample;
-				}
-				sample++;
-				mask = mask >> 1;
+	if (use_lpf) {
+		if (edge_input) {
+			fprintf(stderr, "Low-pass filter can't be used with edge stream input\n");
+			exit(EXIT_FAILURE);
+		}
+		if (lpf_init(&lpf, lpf_depth, lpf_low, lpf_high) != 0) {
+			fprintf(stderr, "Low-pass filter depth must be 1 to %d bits, "
+					"and 0 <= low < high <= depth\n",
+					LPF_MAX_DEPTH);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (! numeric) {
+		somfy_hosts_cache_init(remotes_file);
+		if (somfy_hosts_cache_watch(remotes_file) != 0) {
+			perror("Failed watching remote names file");
+		}
+	}
+
+	if (! flush_frames_set && (low_latency || isatty(STDOUT_FILENO))) {
+		flush_frames = 1;
+	}
+	if (somfy_output_init(&output, stdout, format, numeric, flush_frames,
+				flush_delay) != 0) {
+		perror("Failed writing output");
+		exit(EXIT_FAILURE);
+	}
+
+	if (optind < argc) {
+		return decode_multi(&argv[optind], argc - optind, edge_input,
+					block_size, nworkers);
+	}
+
+	if (input_open(&in, NULL, block_size) != 0) {
+		perror("Failed opening input");
+		exit(EXIT_FAILURE);
+	}
+
+	hdr.sample_rate = 0;
+	if (edge_input && edge_reader_init(&reader, &in, &hdr) != 0) {
+		perror("Failed reading edge stream header");
+		exit(EXIT_FAILURE);
+	}
+
+	rate = decode_rate("stdin", hdr.sample_rate);
+	if (edge_input && start_time == 0) {
+		start_time = hdr.start_time;
+	}
+	classifier_init(&cls, rate);
+	if (somfy_source_init(&src, rate, 1, start_time, track, low_latency,
+				somfy_output_event_cb, &output) != 0) {
+		perror("Failed creating remote tracker");
+		exit(EXIT_FAILURE);
+	}
+	somfy_decoder_init(&dec, &cls, somfy_source_frame_cb, &src);
+	dec.verbose = verbose;
+	edge_scan_init(&es, level_change_cb, &dec);
+	lpf_init(&lpf, lpf_depth, lpf_low, lpf_high);
+
+	// Bit streams are read in whole bytes
+	if (low_latency && input_set_partial(&in, 1, poll_timeout()) != 0) {
+		perror("Failed setting up input");
+		exit(EXIT_FAILURE);
+	}
+
+	if (edge_input) {
+		// Every record ends with a level change
+		while ((ret = edge_reader_next(&reader, &level, &duration)) != 0) {
+			if (ret > 0) {
+				level_change_cb(&dec, !level, duration);
+			} else if (errno == EAGAIN) {
+				periodic(&src, &dec);
+			} else {
+				perror("Failed reading input");
+				exit(EXIT_FAILURE);
+			}
+		}
+		input_close(&in);
+		somfy_classifier_free(&cls);
+		somfy_source_close(&src);
+
+		finish_output();
+		return 0;
+	}
+
+	if ((words = malloc((in.block_size + 7) / 8 * sizeof(uint64_t))) == NULL) {
+		perror("Failed allocating buffer");
+		exit(EXIT_FAILURE);
+	}
+
+	while ((len = input_read(&in, &buf)) != 0) {
+		if (len < 0) {
+			if (errno != EAGAIN) {
+				perror("Failed reading input");
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			nbits = edge_scan_load_bytes(buf, len, words);
+			if (use_lpf) {
+				lpf_filter(&lpf, words, nbits);
 			}
+			scan_bits(&es, &dec, words, nbits);
 		}
+		periodic(&src, &dec);
 	}
 
-	level_change_cb(!level, sample - last_change);
+	edge_scan_flush(&es);
+
+	free(words);
+	input_close(&in);
+	somfy_classifier_free(&cls);
+	somfy_source_close(&src);
 
-	printf("\n");
+	finish_output();
 	return 0;
 }
@@ -0,0 +1,435 @@
+/**
+ * decode_somfy_am.c - Decode Somfy RTS packets from AM levels
+ *
+ * Combines am_to_ook and decode_somfy in a single process. The AM levels are
+ * thresholded and down-sampled and the resulting bits are fed straight into the
+ * Somfy decoder, without packing them into bytes and passing them through a
+ * pipe.
+ *
+ * Usage:
+ * ------
+ *   rtl_fm -M am -g 5 -f 433.42M -s 270K | ./decoders/decode_somfy_am -t 1500
+ *
+ * This is equivalent to:
+ *   rtl_fm -M am -g 5 -f 433.42M -s 270K | \
+ *      ./converters/am_to_ook -d 10 -t 1500 -  | \
+ *      ./decoders/decode_somfy
+ *
+ * With -i input is processed as soon as it arrives and every frame is flushed
+ * right away, to keep the delay between receiving and printing a frame low.
+ *
+ * Frames are tagged with the input sample index of the start of the preamble
+ * and of the last level change. With -E the frame time is derived from these
+ * instead of the time the frame was decoded.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "edge_scan.h"
+#include "input.h"
+#include "ook_slicer.h"
+#include "somfy_detect.h"
+#include "somfy.h"
+#include "somfy_hosts.h"
+#include "somfy_output.h"
+#include "somfy_track.h"
+
+#define REMOTES_FILE "remotes.txt"
+
+#define THRESHOLD 0x4000
+#define HYSTERESIS 20
+// Chunks kept after an active chunk when gating idle chunks
+#define GATE_HOLD 2
+#define DOWNSAMPLE_RATE 10
+// Input sample rate that gives SOMFY_SAMPLE_RATE after down-sampling
+#define INPUT_SAMPLE_RATE (SOMFY_SAMPLE_RATE * DOWNSAMPLE_RATE)
+
+int numeric = 0;
+struct somfy_output output;
+// Maximum time between checks for expired events in low latency mode
+#define EXPIRE_INTERVAL_MS 100
+
+void usage(char *my_name) {
+	fprintf(stderr, "Decode Somfy RTS from AM levels\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s [options] [<input>]\n", my_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, " -b <size>   Read input in blocks of given size\n");
+	fprintf(stderr, " -d <ratio>  Down-sample with given ratio (default: %d)\n",
+			DOWNSAMPLE_RATE);
+	fprintf(stderr, " -s <rate>   Input sample rate in Hz (default: %d)\n",
+			INPUT_SAMPLE_RATE);
+	fprintf(stderr, " -E <time>   Time of the first input sample in seconds "
+			"since the Unix epoch,\n");
+	fprintf(stderr, "             or 'now' (default: unknown)\n");
+	fprintf(stderr, " -S <us>     Symbol time in microseconds (default: "
+			"%d)\n", SOMFY_SYMBOL_TIME);
+	fprintf(stderr, " -t <level>  Set threshold above which a sample is "
+			"considered '1'\n");
+	fprintf(stderr, " -A          Adapt threshold to the signal level "
+			"instead of using -t\n");
+	fprintf(stderr, " -H <pct>    Hysteresis of adaptive threshold in "
+			"percent (default: %d)\n", HYSTERESIS);
+	fprintf(stderr, " -g <count>  Treat chunks of %d samples with fewer "
+			"than count samples\n", OOK_SLICER_CHUNK);
+	fprintf(stderr, "             above the threshold as idle\n");
+	fprintf(stderr, " -M <level>  Only decode transmissions found by "
+			"correlating with the sync\n");
+	fprintf(stderr, "             pattern, with a carrier at least this "
+			"far above the noise floor.\n");
+	fprintf(stderr, "             The threshold is set per transmission, "
+			"-t and -A are ignored\n");
+	fprintf(stderr, " -i          Low latency mode, process input as soon "
+			"as it arrives and flush\n");
+	fprintf(stderr, "             output after every frame\n");
+	fprintf(stderr, " -1          Use single line output mode, same as -o "
+			"oneline\n");
+	fprintf(stderr, " -o <format> Output format: long, oneline, json or "
+			"binary (default: long)\n");
+	fprintf(stderr, " -F <frames> Flush output after this many frames "
+			"(default: 1 if output is a\n");
+	fprintf(stderr, "             terminal, else no limit)\n");
+	fprintf(stderr, " -W <ms>     Flush output when a frame has waited "
+			"this long, 0 for no limit\n");
+	fprintf(stderr, "             (default: %d)\n", SOMFY_OUTPUT_DELAY / 1000);
+	fprintf(stderr, " -n          Don't display human readable control and "
+			"address names\n");
+	fprintf(stderr, " -u          Print repeated frames once, with the number "
+			"of repeats, and warn\n");
+	fprintf(stderr, "             about rolling codes that don't "
+			"increase\n");
+	fprintf(stderr, " -r <file>   Read remote names from file (default: "
+			"%s)\n", REMOTES_FILE);
+	fprintf(stderr, " -v          Increase verbose level, can be used "
+			"multiple times\n");
+	fprintf(stderr, " -h          Display this help\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "When input is not specified or equal to '-', stdin is "
+			"used\n");
+}
+
+void level_change_cb(void *arg, int new_level, uint64_t len)
+{
+	somfy_decoder_level_change((struct somfy_decoder *) arg, new_level, len);
+}
+
+int main(int argc, char *argv[])
+{
+	struct input in;
+	const char *ifile = NULL;
+	size_t block_size = 0;
+	int downsample_rate = DOWNSAMPLE_RATE;
+	uint32_t sample_rate = INPUT_SAMPLE_RATE;
+	uint64_t start_time = 0;
+
+	int opt;
+	const char *remotes_file = REMOTES_FILE;
+	int verbose = 0;
+	uint32_t symbol_time = SOMFY_SYMBOL_TIME;
+	uint16_t threshold = THRESHOLD;
+	bool adaptive = false;
+	int hysteresis = HYSTERESIS;
+	uint16_t min_level = 0;
+	unsigned int gate_min = 0;
+
+	struct ook_slicer slicer;
+	struct somfy_detect detect;
+	struct somfy_classifier cls;
+	struct somfy_decoder dec;
+	struct edge_scan es;
+	bool track = false;
+	bool low_latency = false;
+	int timeout;
+	struct somfy_source src;
+	enum somfy_output_format format = SOMFY_OUTPUT_LONG;
+	unsigned int flush_frames = 0;
+	bool flush_frames_set = false;
+	uint64_t flush_delay = SOMFY_OUTPUT_DELAY;
+
+	ssize_t len;
+	const uint8_t *data;
+	const uint16_t *vals;
+	size_t nvals;
+	uint16_t *detected = NULL;
+	size_t max_vals;
+	uint64_t *words;
+	size_t nwords;
+	int nbits;
+
+	while ((opt = getopt(argc, argv, "b:d:s:E:S:t:AH:g:M:i1o:F:W:nur:vh")) != -1) {
+		switch (opt) {
+		case 'b':
+			block_size = strtol(optarg, NULL, 0);
+			// Keep blocks a whole number of samples
+			block_size = (block_size + 1) & ~1;
+			break;
+		case 'd':
+			downsample_rate = strtol(optarg, NULL, 0);
+			if (downsample_rate <= 0) {
+				downsample_rate = 1;
+			}
+			break;
+		case 's':
+			sample_rate = strtoul(optarg, NULL, 0);
+			if (sample_rate == 0) {
+				sample_rate = INPUT_SAMPLE_RATE;
+			}
+			break;
+		case 'E':
+			if (strcmp(optarg, "now") == 0) {
+				start_time = somfy_realtime_us();
+			} else {
+				start_time = strtod(optarg, NULL) * 1000000;
+			}
+			break;
+		case 'S':
+			symbol_time = strtoul(optarg, NULL, 0);
+			if (symbol_time == 0) {
+				symbol_time = SOMFY_SYMBOL_TIME;
+			}
+			break;
+		case 't':
+			threshold = strtol(optarg, NULL, 0);
+			break;
+		case 'A':
+			adaptive = true;
+			break;
+		case 'H':
+			hysteresis = strtol(optarg, NULL, 0);
+			if (hysteresis < 0 || hysteresis > 100) {
+				fprintf(stderr, "Hysteresis must be between "
+						"0 and 100 percent\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'g':
+			gate_min = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			min_level = strtoul(optarg, NULL, 0);
+			if (min_level == 0) {
+				fprintf(stderr, "Minimal level must be above "
+						"0\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'i':
+			low_latency = true;
+			break;
+		case '1':
+			format = SOMFY_OUTPUT_ONELINE;
+			break;
+		case 'o':
+			if (somfy_output_parse_format(optarg, &format) != 0) {
+				fprintf(stderr, "Unknown output format: %s\n",
+						optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'F':
+			flush_frames = strtoul(optarg, NULL, 0);
+			flush_frames_set = true;
+			break;
+		case 'W':
+			flush_delay = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'n':
+			numeric = 1;
+			break;
+		case 'u':
+			track = true;
+			break;
+		case 'r':
+			remotes_file = optarg;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default: /* '?' */
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind > 1) {
+		fprintf(stderr, "Too many arguments\n");
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	// Input file
+	if (argc - optind > 0) {
+		ifile = argv[optind];
+		optind++;
+	}
+	if (input_open(&in, ifile, block_size) != 0) {
+		perror("Failed opening input file");
+		exit(EXIT_FAILURE);
+	}
+	max_vals = in.block_size / 2;
+	if (min_level != 0) {
+		if (somfy_detect_init(&detect, sample_rate, symbol_time,
+					min_level) != 0) {
+			perror("Failed setting up preamble detection");
+			exit(EXIT_FAILURE);
+		}
+		if (detect.delay > max_vals) {
+			max_vals = detect.delay;
+		}
+		detected = malloc(max_vals * sizeof(uint16_t));
+		if (detected == NULL) {
+			perror("Failed allocating buffer");
+			exit(EXIT_FAILURE);
+		}
+	}
+	words = malloc(ook_slicer_max_words(max_vals) * sizeof(uint64_t));
+	if (words == NULL) {
+		perror("Failed allocating buffer");
+		exit(EXIT_FAILURE);
+	}
+
+	if (! numeric) {
+		somfy_hosts_cache_init(remotes_file);
+		if (somfy_hosts_cache_watch(remotes_file) != 0) {
+			perror("Failed watching remote names file");
+		}
+	}
+
+	if (! flush_frames_set && (low_latency || isatty(STDOUT_FILENO))) {
+		flush_frames = 1;
+	}
+	if (somfy_output_init(&output, stdout, format, numeric, flush_frames,
+				flush_delay) != 0) {
+		perror("Failed writing output");
+		exit(EXIT_FAILURE);
+	}
+
+	if (min_level != 0) {
+		// The detector moves the best threshold here
+		ook_slicer_init(&slicer, SOMFY_DETECT_THRESHOLD,
+				downsample_rate);
+	} else {
+		ook_slicer_init(&slicer, threshold, downsample_rate);
+	}
+	if (adaptive && min_level == 0) {
+		ook_slicer_set_adaptive(&slicer, hysteresis);
+	}
+	ook_slicer_set_gate(&slicer, gate_min, GATE_HOLD);
+	if (somfy_classifier_init(&cls, sample_rate / downsample_rate,
+					symbol_time) != 0) {
+		perror("Failed building pulse classifier");
+		exit(EXIT_FAILURE);
+	}
+	// Report input sample indexes, not down-sampled ones
+	if (somfy_source_init(&src, sample_rate, downsample_rate, start_time,
+				track, low_latency, somfy_output_event_cb,
+				&output) != 0) {
+		perror("Failed creating remote tracker");
+		exit(EXIT_FAILURE);
+	}
+	somfy_decoder_init(&dec, &cls, somfy_source_frame_cb, &src);
+	dec.verbose = verbose;
+	edge_scan_init(&es, level_change_cb, &dec);
+
+	if (low_latency) {
+		// Wake up in time to expire events and flush output
+		timeout = track ? EXPIRE_INTERVAL_MS : -1;
+		if (flush_delay != 0 &&
+		    (timeout == -1 || flush_delay / 1000 < (uint64_t) timeout)) {
+			timeout = flush_delay / 1000 + 1;
+		}
+		if (input_set_partial(&in, 2, timeout) != 0) {
+			perror("Failed setting up input");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	while ((len = input_read(&in, &data)) != 0) {
+		if (len < 0) {
+			if (errno != EAGAIN) {
+				perror("Failed reading input");
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			vals = (const uint16_t *) data;
+			nvals = len / 2;
+			if (min_level != 0) {
+				nvals = somfy_detect_push(&detect, vals, nvals,
+								detected);
+				vals = detected;
+			}
+			nwords = ook_slicer_push(&slicer, vals, nvals, words);
+			edge_scan_push(&es, words, nwords * 64);
+			// Report a frame as soon as the gap after it is seen
+			somfy_decoder_idle(&dec, es.level,
+					es.sample - es.last_change);
+		}
+		somfy_source_expire(&src, &dec);
+		if (somfy_output_poll(&output) != 0) {
+			perror("Failed writing output");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (min_level != 0) {
+		nvals = somfy_detect_flush(&detect, detected);
+		nwords = ook_slicer_push(&slicer, detected, nvals, words);
+		edge_scan_push(&es, words, nwords * 64);
+	}
+	nbits = ook_slicer_flush(&slicer, words);
+	edge_scan_push(&es, words, nbits);
+
+	edge_scan_flush(&es);
+	somfy_source_close(&src);
+
+	if (format == SOMFY_OUTPUT_LONG || format == SOMFY_OUTPUT_ONELINE) {
+		printf("\n");
+	}
+	if (somfy_output_close(&output) != 0) {
+		perror("Failed writing output");
+		exit(EXIT_FAILURE);
+	}
+
+	free(words);
+	if (min_level != 0) {
+		free(detected);
+		somfy_detect_free(&detect);
+	}
+	input_close(&in);
+	somfy_classifier_free(&cls);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+/**
+ * am_format.c - Conversion of AM level sample formats
+ *
+ * The conversion loops are generated by CONVERT_FORMAT() from an expression
+ * per format. Bytes are assembled explicitly, so the loops don't depend on
+ * the alignment of the input or the byte order of the host, and the compiler
+ * can vectorize them.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "am_format.h"
+
+#include <errno.h>
+#include <string.h>
+
+static inline uint16_t load_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint16_t load_be16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t load_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint16_t clamp_s16(int16_t v)
+{
+	return v < 0 ? 0 : v;
+}
+
+static inline uint16_t clamp_s32(int32_t v)
+{
+	return v < 0 ? 0 : v >> 16;
+}
+
+static inline uint16_t clamp_f32(uint32_t bits)
+{
+	float v;
+
+	memcpy(&v, &bits, sizeof(v));
+	// Also maps NaN to 0
+	if (! (v > 0))
+		return 0;
+	if (v >= 2.0f)
+		return UINT16_MAX;
+	return v * 32768.0f;
+}
+
+/*
+ * Define conversion loop for format with given sample size, the expression
+ * converts the sample at p
+ */
+#define CONVERT_FORMAT(name, size, expr)				\
+static void convert_##name(const uint8_t *in, size_t n, uint16_t *out)	\
+{									\
+	size_t i;							\
+									\
+	for (i = 0; i < n; i++) {					\
+		const uint8_t *p = &in[i * (size)];			\
+		out[i] = (expr);					\
+	}								\
+}
+
+CONVERT_FORMAT(u8, 1, p[0] << 8)
+CONVERT_FORMAT(s8, 1, clamp_s16((int8_t) p[0] * 256))
+CONVERT_FORMAT(u16be, 2, load_be16(p))
+CONVERT_FORMAT(s16le, 2, clamp_s16(load_le16(p)))
+CONVERT_FORMAT(s16be, 2, clamp_s16(load_be16(p)))
+CONVERT_FORMAT(s32le, 4, clamp_s32(load_le32(p)))
+CONVERT_FORMAT(f32le, 4, clamp_f32(load_le32(p)))
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// Already in host order, used as is
+# define convert_u16le NULL
+#else
+CONVERT_FORMAT(u16le, 2, load_le16(p))
+#endif
+
+static const struct am_format formats[] = {
+	{ "u8",		1,	convert_u8 },
+	{ "s8",		1,	convert_s8 },
+	{ "u16le",	2,	convert_u16le },
+	{ "u16be",	2,	convert_u16be },
+	{ "s16le",	2,	convert_s16le },
+	{ "s16be",	2,	convert_s16be },
+	{ "s32le",	4,	convert_s32le },
+	{ "f32le",	4,	convert_f32le },
+};
+
+int am_format_init(struct am_format *fmt, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (strcmp(formats[i].name, name) == 0) {
+			*fmt = formats[i];
+			return 0;
+		}
+	}
+
+	errno = EINVAL;
+	return -1;
+}
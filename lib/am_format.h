@@ -0,0 +1,83 @@
+/**
+ * am_format.h - Conversion of AM level sample formats
+ *
+ * rtl_fm writes AM levels as 16-bit integers, but other SDR tools use other
+ * sample formats. These are converted to the unsigned 16-bit levels the OOK
+ * slicer works on. Every format has its own conversion loop, so there is no
+ * per sample branch on the format.
+ *
+ * Signed formats keep the scale of 16-bit signed samples, so full scale is
+ * 32768 and negative levels become 0. Unsigned formats use the full 16-bit
+ * range. Float samples have a full scale of 1.0.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __AM_FORMAT_H__
+#define __AM_FORMAT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*am_convert_fn_t)(const uint8_t *in, size_t n, uint16_t *out);
+
+struct am_format {
+	const char *name;
+	// Bytes per sample
+	size_t sample_size;
+	// NULL if the input already is in host order unsigned 16-bit
+	am_convert_fn_t convert_block;
+};
+
+/**
+ * Look up sample format
+ *
+ * @param name	Format name: u8, s8, u16le, u16be, s16le, s16be, s32le or
+ *		f32le
+ *
+ * @returns	0 on success, -1 with errno set to EINVAL for unknown formats
+ */
+int am_format_init(struct am_format *fmt, const char *name);
+
+/**
+ * Convert a block of samples to AM levels
+ *
+ * @param in	n samples of fmt->sample_size bytes each
+ * @param out	Room for n levels, not used if no conversion is needed
+ *
+ * @returns	The levels, either in or out
+ */
+static inline const uint16_t *am_format_convert(const struct am_format *fmt,
+					const uint8_t *in, size_t n,
+					uint16_t *out)
+{
+	if (fmt->convert_block == NULL)
+		return (const uint16_t *) in;
+
+	fmt->convert_block(in, n, out);
+	return out;
+}
+
+#endif // __AM_FORMAT_H__
@@ -0,0 +1,101 @@
+/**
+ * edge_scan.c - Word-wide level change detection
+ *
+ * This gives the same level changes as testing every bit on its own, but only
+ * costs work for every word and every level change.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "edge_scan.h"
+
+#include <string.h>
+
+void edge_scan_init(struct edge_scan *es, edge_cb_t cb, void *cb_arg)
+{
+	es->sample = 0;
+	es->last_change = 0;
+	es->level = 0;
+	es->cb = cb;
+	es->cb_arg = cb_arg;
+}
+
+void edge_scan_push(struct edge_scan *es, const uint64_t *words, size_t nbits)
+{
+	size_t i;
+
+	for (i = 0; i < nbits; i += 64) {
+		size_t n = nbits - i;
+		uint64_t valid;
+		uint64_t diff;
+
+		if (n > 64)
+			n = 64;
+		valid = (n == 64) ? ~0ULL : ~(~0ULL >> n);
+
+		// Set bits differ from the current level
+		diff = (words[i / 64] ^ (es->level ? ~0ULL : 0)) & valid;
+		while (diff != 0) {
+			int k = __builtin_clzll(diff);
+			uint64_t pos = es->sample + k;
+
+			es->cb(es->cb_arg, !es->level, pos - es->last_change);
+			es->level = !es->level;
+			es->last_change = pos;
+
+			// Compare remaining bits against the new level
+			diff ^= (~0ULL >> k) & valid;
+		}
+		es->sample += n;
+	}
+}
+
+void edge_scan_flush(struct edge_scan *es)
+{
+	es->cb(es->cb_arg, !es->level, es->sample - es->last_change);
+}
+
+size_t edge_scan_load_bytes(const uint8_t *buf, size_t len, uint64_t *words)
+{
+	size_t i;
+	uint64_t w;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, &buf[i], sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		w = __builtin_bswap64(w);
+#endif
+		words[i / 8] = w;
+	}
+	if (i < len) {
+		w = 0;
+		for (; i < len; i++) {
+			w |= (uint64_t) buf[i] << (56 - (i & 7) * 8);
+		}
+		words[len / 8] = w;
+	}
+
+	return len * 8;
+}
@@ -0,0 +1,91 @@
+/**
+ * edge_scan.h - Word-wide level change detection
+ *
+ * Finds the level changes in a bit stream. The bit stream is processed 64 bits
+ * at a time: XOR-ing a word with the current level leaves only the bits that
+ * differ from it set, and counting the leading zeros gives the position of the
+ * next level change. Runs without any change are skipped a whole word at a
+ * time.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __EDGE_SCAN_H__
+#define __EDGE_SCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Called for every level change
+ *
+ * @param new_level	Level after the change, 0 or 1
+ * @param len		Length in samples of the previous level
+ */
+typedef void (*edge_cb_t)(void *arg, int new_level, uint64_t len);
+
+struct edge_scan {
+	uint64_t sample;
+	uint64_t last_change;
+	int level;
+
+	edge_cb_t cb;
+	void *cb_arg;
+};
+
+/**
+ * Initialize edge scanner
+ *
+ * The level before the first sample is assumed to be 0.
+ */
+void edge_scan_init(struct edge_scan *es, edge_cb_t cb, void *cb_arg);
+
+/**
+ * Scan bits for level changes
+ *
+ * @param words		Bits, 64 per word with the first bit in the MSB
+ * @param nbits		Number of bits to scan, does not need to be a multiple
+ *			of 64
+ */
+void edge_scan_push(struct edge_scan *es, const uint64_t *words, size_t nbits);
+
+/**
+ * Report the length of the last level
+ *
+ * Calls the callback once more as if the level changes after the last sample.
+ */
+void edge_scan_flush(struct edge_scan *es);
+
+/**
+ * Load packed bit stream bytes into words
+ *
+ * words must have room for (len + 7) / 8 words. The last word is padded with
+ * zero bits.
+ *
+ * @returns	Number of bits loaded, len * 8
+ */
+size_t edge_scan_load_bytes(const uint8_t *buf, size_t len, uint64_t *words);
+
+#endif // __EDGE_SCAN_H__
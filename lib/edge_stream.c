@@ -0,0 +1,281 @@
+/**
+ * edge_stream.c - Run-length encoded edge stream format
+ *
+ * Records are encoded into a buffer that is written when full. The reader
+ * decodes records directly from the input blocks, only falling back to reading
+ * a byte at a time for varints that straddle a block boundary.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "edge_stream.h"
+
+#include <errno.h>
+#include <string.h>
+
+// Maximal size of one record, a 64-bit varint
+#define MAX_RECORD_LEN 10
+
+static void put_le(uint8_t *buf, uint64_t val, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = val >> (i * 8);
+	}
+}
+
+static uint64_t get_le(const uint8_t *buf, int len)
+{
+	uint64_t val = 0;
+	int i;
+
+	for (i = len - 1; i >= 0; i--) {
+		val = (val << 8) | buf[i];
+	}
+	return val;
+}
+
+int edge_writer_init(struct edge_writer *w, FILE *fp,
+			const struct edge_stream_header *hdr)
+{
+	uint8_t buf[EDGE_STREAM_HEADER_SIZE];
+
+	w->fp = fp;
+	w->err = 0;
+	w->len = 0;
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(&buf[0], EDGE_STREAM_MAGIC, 4);
+	buf[4] = EDGE_STREAM_VERSION;
+	put_le(&buf[8], hdr->sample_rate, 4);
+	put_le(&buf[12], hdr->start_time, 8);
+
+	if (fwrite(buf, 1, sizeof(buf), fp) != sizeof(buf)) {
+		w->err = errno;
+		return -1;
+	}
+	return 0;
+}
+
+void edge_writer_put(struct edge_writer *w, int level, uint64_t duration)
+{
+	uint64_t val = (duration << 1) | (level & 1);
+
+	if (duration == 0)
+		return;
+
+	if (w->len + MAX_RECORD_LEN > sizeof(w->buf)) {
+		edge_writer_flush(w);
+	}
+
+	while (val >= 0x80) {
+		w->buf[w->len++] = (val & 0x7f) | 0x80;
+		val >>= 7;
+	}
+	w->buf[w->len++] = val;
+}
+
+void edge_writer_cb(void *arg, int new_level, uint64_t len)
+{
+	edge_writer_put((struct edge_writer *) arg, !new_level, len);
+}
+
+int edge_writer_flush(struct edge_writer *w)
+{
+	if (w->len > 0 && w->err == 0) {
+		if (fwrite(w->buf, 1, w->len, w->fp) != w->len) {
+			w->err = errno;
+		}
+	}
+	w->len = 0;
+
+	if (w->err != 0) {
+		errno = w->err;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Get next input byte
+ *
+ * @returns	Byte value, -1 at end of input, or -2 on error
+ */
+static int next_byte(struct edge_reader *r)
+{
+	ssize_t len;
+
+	if (r->pos == r->len) {
+		if ((len = input_read(r->in, &r->data)) <= 0)
+			return len == 0 ? -1 : -2;
+		r->len = len;
+		r->pos = 0;
+	}
+	return r->data[r->pos++];
+}
+
+/* Check header and store its fields in hdr */
+static int parse_header(const uint8_t *buf, struct edge_stream_header *hdr)
+{
+	if (memcmp(&buf[0], EDGE_STREAM_MAGIC, 4) != 0 ||
+	    buf[4] != EDGE_STREAM_VERSION)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	hdr->sample_rate = get_le(&buf[8], 4);
+	hdr->start_time = get_le(&buf[12], 8);
+
+	return 0;
+}
+
+int edge_reader_init(struct edge_reader *r, struct input *in,
+			struct edge_stream_header *hdr)
+{
+	uint8_t buf[EDGE_STREAM_HEADER_SIZE];
+	size_t i;
+	int c;
+
+	r->in = in;
+	r->data = NULL;
+	r->len = 0;
+	r->pos = 0;
+	r->val = 0;
+	r->shift = 0;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		if ((c = next_byte(r)) < 0) {
+			if (c == -1)
+				errno = EINVAL;
+			return -1;
+		}
+		buf[i] = c;
+	}
+
+	return parse_header(buf, hdr);
+}
+
+int edge_reader_next(struct edge_reader *r, int *level, uint64_t *duration)
+{
+	uint64_t val = 0;
+	int shift = 0;
+	int c;
+
+	// Fast path, whole record is in the current block
+	if (r->shift == 0 && r->len - r->pos >= MAX_RECORD_LEN) {
+		const uint8_t *p = &r->data[r->pos];
+		do {
+			c = *p++;
+			val |= (uint64_t) (c & 0x7f) << shift;
+			shift += 7;
+		} while ((c & 0x80) && shift < 7 * MAX_RECORD_LEN);
+		r->pos = p - r->data;
+	} else {
+		val = r->val;
+		shift = r->shift;
+		do {
+			if ((c = next_byte(r)) < 0) {
+				if (c == -2) {
+					// Keep the partial record for a retry
+					r->val = val;
+					r->shift = shift;
+					return -1;
+				}
+				if (shift == 0)
+					return 0;
+				// Truncated record
+				errno = EINVAL;
+				return -1;
+			}
+			val |= (uint64_t) (c & 0x7f) << shift;
+			shift += 7;
+		} while ((c & 0x80) && shift < 7 * MAX_RECORD_LEN);
+		r->val = 0;
+		r->shift = 0;
+	}
+
+	if ((c & 0x80) || (val >> 1) == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*level = val & 1;
+	*duration = val >> 1;
+	return 1;
+}
+
+void edge_parser_init(struct edge_parser *p)
+{
+	p->hdr_len = 0;
+	p->val = 0;
+	p->shift = 0;
+}
+
+int edge_parser_push(struct edge_parser *p, const uint8_t *buf, size_t len,
+			edge_record_cb_t cb, void *cb_arg)
+{
+	size_t i = 0;
+	uint8_t c;
+
+	while (p->hdr_len < EDGE_STREAM_HEADER_SIZE && i < len) {
+		p->hdr_buf[p->hdr_len++] = buf[i++];
+		if (p->hdr_len == EDGE_STREAM_HEADER_SIZE &&
+		    parse_header(p->hdr_buf, &p->hdr) != 0)
+			return -1;
+	}
+
+	for (; i < len; i++) {
+		c = buf[i];
+		p->val |= (uint64_t) (c & 0x7f) << p->shift;
+		p->shift += 7;
+		if (c & 0x80) {
+			if (p->shift >= 7 * MAX_RECORD_LEN) {
+				errno = EINVAL;
+				return -1;
+			}
+			continue;
+		}
+
+		if ((p->val >> 1) == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		cb(cb_arg, p->val & 1, p->val >> 1);
+		p->val = 0;
+		p->shift = 0;
+	}
+
+	return 0;
+}
+
+int edge_parser_finish(struct edge_parser *p)
+{
+	if (p->hdr_len != EDGE_STREAM_HEADER_SIZE || p->shift != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * edge_stream.h - Run-length encoded edge stream format
+ *
+ * An edge stream stores a bit stream as the lengths of its runs of equal level.
+ * For OOK signals almost all samples are equal to their predecessor, so this is
+ * much smaller than a packed bit stream.
+ *
+ * The stream starts with a header of EDGE_STREAM_HEADER_SIZE bytes, multi-byte
+ * fields are little endian:
+ *
+ *   offset  size  field
+ *   0       4     magic, "OOKE"
+ *   4       1     version, EDGE_STREAM_VERSION
+ *   5       3     reserved, must be 0
+ *   8       4     sample rate in Hz, 0 if unknown
+ *   12      8     start time in microseconds since the Unix epoch, 0 if unknown
+ *
+ * The header is followed by records until the end of the stream. Every record
+ * is a single unsigned LEB128 varint, 7 bits per byte starting with the least
+ * significant bits and bit 7 set on all but the last byte, with the value:
+ *
+ *   duration << 1 | level
+ *
+ * where level is 0 or 1 and duration is the number of samples the signal has
+ * that level. Records normally alternate in level. Records with a duration of 0
+ * are reserved.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __EDGE_STREAM_H__
+#define __EDGE_STREAM_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "input.h"
+
+#define EDGE_STREAM_MAGIC "OOKE"
+#define EDGE_STREAM_VERSION 1
+#define EDGE_STREAM_HEADER_SIZE 20
+
+#define EDGE_WRITER_BUF_SIZE 4096
+
+struct edge_stream_header {
+	uint32_t sample_rate;
+	uint64_t start_time;
+};
+
+struct edge_writer {
+	FILE *fp;
+	int err;
+	size_t len;
+	uint8_t buf[EDGE_WRITER_BUF_SIZE];
+};
+
+struct edge_reader {
+	struct input *in;
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+
+	// Partially read record
+	uint64_t val;
+	int shift;
+};
+
+/**
+ * Called for every record by edge_parser_push()
+ */
+typedef void (*edge_record_cb_t)(void *arg, int level, uint64_t duration);
+
+struct edge_parser {
+	struct edge_stream_header hdr;
+	size_t hdr_len;
+	uint8_t hdr_buf[EDGE_STREAM_HEADER_SIZE];
+
+	// Partially received record
+	uint64_t val;
+	int shift;
+};
+
+/**
+ * Initialize edge stream writer and write the header
+ *
+ * @returns	0 on success, -1 on error with errno set
+ */
+int edge_writer_init(struct edge_writer *w, FILE *fp,
+			const struct edge_stream_header *hdr);
+
+/**
+ * Add record to edge stream
+ *
+ * Records are buffered, write errors are reported by edge_writer_flush().
+ * Records with a duration of 0 are dropped.
+ */
+void edge_writer_put(struct edge_writer *w, int level, uint64_t duration);
+
+/**
+ * Edge scanner callback writing the level changes as records
+ *
+ * @param arg	Pointer to struct edge_writer
+ */
+void edge_writer_cb(void *arg, int new_level, uint64_t len);
+
+/**
+ * Write buffered records
+ *
+ * @returns	0 on success, -1 if this or an earlier write failed, with
+ *		errno set
+ */
+int edge_writer_flush(struct edge_writer *w);
+
+/**
+ * Initialize edge stream reader and read the header
+ *
+ * @returns	0 on success, -1 on error with errno set. errno is EINVAL if
+ *		the input isn't an edge stream.
+ */
+int edge_reader_init(struct edge_reader *r, struct input *in,
+			struct edge_stream_header *hdr);
+
+/**
+ * Read next record
+ *
+ * If the input fails with EAGAIN, see input_set_partial(), a partially read
+ * record is kept and the call can be repeated when more input is available.
+ *
+ * @returns	1 if a record is read, 0 at the end of the stream, -1 on error
+ *		with errno set
+ */
+int edge_reader_next(struct edge_reader *r, int *level, uint64_t *duration);
+
+/**
+ * Initialize push parser
+ *
+ * The parser is an alternative to edge_reader for input that arrives in
+ * arbitrary pieces, like from non-blocking file descriptors.
+ */
+void edge_parser_init(struct edge_parser *p);
+
+/**
+ * Parse next piece of edge stream
+ *
+ * Records may be split over multiple pieces. hdr is valid once the first
+ * EDGE_STREAM_HEADER_SIZE bytes are parsed.
+ *
+ * @returns	0 on success, -1 if the input isn't a valid edge stream with
+ *		errno set to EINVAL
+ */
+int edge_parser_push(struct edge_parser *p, const uint8_t *buf, size_t len,
+			edge_record_cb_t cb, void *cb_arg);
+
+/**
+ * Check for a partially received record at the end of the stream
+ *
+ * @returns	0 if the stream ended on a record boundary, else -1 with errno
+ *		set to EINVAL
+ */
+int edge_parser_finish(struct edge_parser *p);
+
+#endif // __EDGE_STREAM_H__
@@ -0,0 +1,230 @@
+/**
+ * input.c - Block based input from files, pipes and stdin
+ *
+ * Mapped files are advised as MADV_SEQUENTIAL, so the kernel reads ahead
+ * aggressively and can drop pages once they are passed.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "input.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Map the rest of the file starting at the current offset */
+static int input_map(struct input *in, const struct stat *st)
+{
+	off_t offset;
+	uint8_t *map;
+
+	if ((offset = lseek(in->fd, 0, SEEK_CUR)) < 0)
+		return -1;
+	if (offset >= st->st_size) {
+		// Nothing to map, behave as empty mapping
+		in->map = (uint8_t *) "";
+		in->map_len = 0;
+		in->map_pos = 0;
+		return 0;
+	}
+
+	map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise(map, st->st_size, MADV_SEQUENTIAL);
+
+	in->map = map;
+	in->map_len = st->st_size;
+	in->map_pos = offset;
+
+	return 0;
+}
+
+int input_open(struct input *in, const char *path, size_t block_size)
+{
+	struct stat st;
+	int err;
+
+	memset(in, 0, sizeof(*in));
+	in->fd = STDIN_FILENO;
+
+	if (path != NULL && strcmp(path, "-") != 0) {
+		if ((in->fd = open(path, O_RDONLY)) == -1)
+			return -1;
+	}
+
+	if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    input_map(in, &st) == 0)
+	{
+		in->block_size = block_size ? block_size : INPUT_MAP_BLOCK_SIZE;
+		return 0;
+	}
+
+	in->block_size = block_size ? block_size : INPUT_STREAM_BLOCK_SIZE;
+	if ((in->buf = malloc(in->block_size)) == NULL) {
+		err = errno;
+		if (in->fd != STDIN_FILENO)
+			close(in->fd);
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int input_set_partial(struct input *in, size_t unit, int timeout)
+{
+	int flags;
+
+	if (in->map != NULL)
+		return 0;
+	if (unit == 0 || unit > in->block_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((flags = fcntl(in->fd, F_GETFL)) == -1 ||
+	    fcntl(in->fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+
+	in->partial = true;
+	in->unit = unit;
+	in->timeout = timeout;
+	return 0;
+}
+
+/* Read available data, waiting at most in->timeout for it */
+static ssize_t input_read_partial(struct input *in, const uint8_t **data)
+{
+	struct pollfd pfd = { .fd = in->fd, .events = POLLIN };
+	size_t len;
+	ssize_t ret;
+
+	// Move the incomplete unit of the last block to the front
+	if (in->carry > 0)
+		memmove(in->buf, &in->buf[in->last], in->carry);
+	len = in->carry;
+	in->carry = 0;
+	in->last = 0;
+
+	while (len < in->unit) {
+		ret = read(in->fd, &in->buf[len], in->block_size - len);
+		if (ret > 0) {
+			len += ret;
+			continue;
+		}
+		if (ret == 0) {
+			// Return the incomplete unit at the end of file
+			*data = in->buf;
+			return len;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -1;
+
+		ret = poll(&pfd, 1, in->timeout);
+		if (ret < 0 && errno != EINTR)
+			return -1;
+		if (ret == 0) {
+			in->carry = len;
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	in->last = len - len % in->unit;
+	in->carry = len - in->last;
+	*data = in->buf;
+	return in->last;
+}
+
+ssize_t input_read(struct input *in, const uint8_t **data)
+{
+	size_t len = 0;
+	ssize_t ret;
+
+	if (in->map != NULL) {
+		len = in->map_len - in->map_pos;
+		if (len > in->block_size)
+			len = in->block_size;
+		*data = &in->map[in->map_pos];
+		in->map_pos += len;
+		return len;
+	}
+
+	if (in->partial)
+		return input_read_partial(in, data);
+
+	// Fill the whole block, like fread() does
+	while (len < in->block_size) {
+		ret = read(in->fd, &in->buf[len], in->block_size - len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		len += ret;
+	}
+
+	*data = in->buf;
+	return len;
+}
+
+const uint8_t *input_read_all(struct input *in, size_t align, size_t *len)
+{
+	const uint8_t *data;
+
+	if (in->map == NULL)
+		return NULL;
+
+	data = &in->map[in->map_pos];
+	// The map starts at a page, but stdin may be at any offset
+	if ((uintptr_t) data % align != 0)
+		return NULL;
+	*len = in->map_len - in->map_pos;
+	in->map_pos = in->map_len;
+
+	return data;
+}
+
+void input_close(struct input *in)
+{
+	if (in->map != NULL && in->map_len > 0)
+		munmap(in->map, in->map_len);
+	free(in->buf);
+	if (in->fd != STDIN_FILENO)
+		close(in->fd);
+	memset(in, 0, sizeof(*in));
+	in->fd = -1;
+}
@@ -0,0 +1,119 @@
+/**
+ * input.h - Block based input from files, pipes and stdin
+ *
+ * Gives the tools their input in blocks. Regular files are memory mapped and
+ * the blocks point straight into the mapping, other inputs, like pipes and
+ * terminals, are read into a buffer.
+ *
+ * Read input normally waits for a whole block. For live input, where latency
+ * matters, input_set_partial() makes it return whatever data has arrived.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INPUT_H__
+#define __INPUT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Default block size for inputs that are read
+#define INPUT_STREAM_BLOCK_SIZE 4096
+// Default block size for inputs that are memory mapped
+#define INPUT_MAP_BLOCK_SIZE (1 << 20)
+
+struct input {
+	int fd;
+	size_t block_size;
+
+	// Memory mapped input
+	uint8_t *map;
+	size_t map_len;
+	size_t map_pos;
+
+	// Read input
+	uint8_t *buf;
+
+	// Partial block mode, see input_set_partial()
+	bool partial;
+	size_t unit;
+	int timeout;
+	size_t last;
+	size_t carry;
+};
+
+/**
+ * Open input
+ *
+ * @param path		File to open, stdin is used if NULL or "-"
+ * @param block_size	Maximum number of bytes returned by input_read(), or 0
+ *			to use a default depending on the input type
+ *
+ * @returns	0 on success, -1 on error with errno set
+ */
+int input_open(struct input *in, const char *path, size_t block_size);
+
+/**
+ * Return available input without waiting for a whole block
+ *
+ * Makes the input non-blocking. input_read() then waits with poll() for data
+ * and returns what is available, up to a block, rounded down to a multiple of
+ * unit bytes. The rest is kept for the next block. If no data arrives within
+ * timeout milliseconds input_read() fails with EAGAIN, so the caller can do
+ * periodic work. A negative timeout waits forever.
+ *
+ * Memory mapped input is always available, it isn't affected.
+ *
+ * @returns	0 on success, -1 on error with errno set
+ */
+int input_set_partial(struct input *in, size_t unit, int timeout);
+
+/**
+ * Get next block of input
+ *
+ * Blocks are always in->block_size bytes, except for the last one, or in
+ * partial mode. The data stays valid until the next call.
+ *
+ * @returns	Length of block, 0 on end of file or -1 on error with errno set
+ */
+ssize_t input_read(struct input *in, const uint8_t **data);
+
+/**
+ * Get all remaining input at once
+ *
+ * Only possible for memory mapped input. Consumes the remaining input.
+ *
+ * @param align	Required alignment of the returned data in bytes
+ *
+ * @returns	Remaining input, or NULL if the input is not memory mapped or
+ *		not aligned, in which case nothing is consumed
+ */
+const uint8_t *input_read_all(struct input *in, size_t align, size_t *len);
+
+void input_close(struct input *in);
+
+#endif // __INPUT_H__
@@ -0,0 +1,234 @@
+/**
+ * iq_envelope.c - Envelope detection of complex IQ samples
+ *
+ * Like the threshold kernels of the OOK slicer, the envelope is computed with
+ * SSE2 or AVX2 when the CPU supports it. The vector kernels give exactly the
+ * same levels as the scalar ones.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "iq_envelope.h"
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_SIMD
+# include <immintrin.h>
+#endif
+
+/* Alpha max plus beta min with alpha = 1 and beta = 3/8 */
+static inline uint16_t magnitude(uint16_t a, uint16_t b)
+{
+	uint16_t mx = a > b ? a : b;
+	uint16_t mn = a > b ? b : a;
+
+	return mx + (mn >> 2) + (mn >> 3);
+}
+
+/*
+ * Envelope kernels
+ *
+ * Convert n complex samples to AM levels.
+ */
+static void envelope_cu8_scalar(const uint8_t *iq, size_t n, uint16_t *out)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint8_t a = iq[2 * i] >= 128 ? iq[2 * i] - 128 : 128 - iq[2 * i];
+		uint8_t b = iq[2 * i + 1] >= 128 ? iq[2 * i + 1] - 128 :
+							128 - iq[2 * i + 1];
+		out[i] = magnitude(a, b) << 8;
+	}
+}
+
+static void envelope_cs16_scalar(const uint8_t *iq, size_t n, uint16_t *out)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		int16_t v[2];
+		memcpy(v, &iq[4 * i], sizeof(v));
+		// Absolute value of -32768 is 32768, which fits a uint16_t
+		out[i] = magnitude(v[0] < 0 ? -v[0] : v[0],
+					v[1] < 0 ? -v[1] : v[1]);
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * cu8: one sample is one 16-bit lane. The absolute values are computed on the
+ * bytes, then I and Q are swapped within the lane to get the max and min.
+ */
+__attribute__((target("sse2")))
+static void envelope_cu8_sse2(const uint8_t *iq, size_t n, uint16_t *out)
+{
+	const __m128i offset = _mm_set1_epi8((char) 128);
+	const __m128i low_mask = _mm_set1_epi16(0x00FF);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &iq[2 * i]);
+		__m128i sw, mx, mn;
+
+		v = _mm_or_si128(_mm_subs_epu8(v, offset),
+					_mm_subs_epu8(offset, v));
+		sw = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		mx = _mm_and_si128(_mm_max_epu8(v, sw), low_mask);
+		mn = _mm_and_si128(_mm_min_epu8(v, sw), low_mask);
+		v = _mm_add_epi16(mx, _mm_add_epi16(_mm_srli_epi16(mn, 2),
+						_mm_srli_epi16(mn, 3)));
+		_mm_storeu_si128((__m128i *) &out[i], _mm_slli_epi16(v, 8));
+	}
+	envelope_cu8_scalar(&iq[2 * i], n - i, &out[i]);
+}
+
+__attribute__((target("avx2")))
+static void envelope_cu8_avx2(const uint8_t *iq, size_t n, uint16_t *out)
+{
+	const __m256i offset = _mm256_set1_epi8((char) 128);
+	const __m256i low_mask = _mm256_set1_epi16(0x00FF);
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) &iq[2 * i]);
+		__m256i sw, mx, mn;
+
+		v = _mm256_or_si256(_mm256_subs_epu8(v, offset),
+					_mm256_subs_epu8(offset, v));
+		sw = _mm256_or_si256(_mm256_slli_epi16(v, 8),
+					_mm256_srli_epi16(v, 8));
+		mx = _mm256_and_si256(_mm256_max_epu8(v, sw), low_mask);
+		mn = _mm256_and_si256(_mm256_min_epu8(v, sw), low_mask);
+		v = _mm256_add_epi16(mx, _mm256_add_epi16(
+						_mm256_srli_epi16(mn, 2),
+						_mm256_srli_epi16(mn, 3)));
+		_mm256_storeu_si256((__m256i *) &out[i],
+					_mm256_slli_epi16(v, 8));
+	}
+	envelope_cu8_scalar(&iq[2 * i], n - i, &out[i]);
+}
+
+/*
+ * cs16: one sample is one 32-bit lane. The magnitude ends up in both halves
+ * of the lane, the low halves of two vectors are packed into one.
+ */
+__attribute__((target("sse2")))
+static inline __m128i magnitude_cs16_sse2(__m128i v)
+{
+	// SSE2 only has signed 16-bit max and min, so flip the sign bit
+	const __m128i bias = _mm_set1_epi16((short) 0x8000);
+	__m128i sw, mx, mn;
+
+	v = _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+	v = _mm_xor_si128(v, bias);
+	sw = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+	mx = _mm_xor_si128(_mm_max_epi16(v, sw), bias);
+	mn = _mm_xor_si128(_mm_min_epi16(v, sw), bias);
+	v = _mm_add_epi16(mx, _mm_add_epi16(_mm_srli_epi16(mn, 2),
+					_mm_srli_epi16(mn, 3)));
+	// Sign extend the low half, so packing doesn't saturate
+	return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+__attribute__((target("sse2")))
+static void envelope_cs16_sse2(const uint8_t *iq, size_t n, uint16_t *out)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		const __m128i *p = (const __m128i *) &iq[4 * i];
+		__m128i a = magnitude_cs16_sse2(_mm_loadu_si128(p));
+		__m128i b = magnitude_cs16_sse2(_mm_loadu_si128(p + 1));
+		_mm_storeu_si128((__m128i *) &out[i], _mm_packs_epi32(a, b));
+	}
+	envelope_cs16_scalar(&iq[4 * i], n - i, &out[i]);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i magnitude_cs16_avx2(__m256i v)
+{
+	__m256i sw, mx, mn;
+
+	// abs(-32768) is 0x8000, which is right when read unsigned
+	v = _mm256_abs_epi16(v);
+	sw = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xB1), 0xB1);
+	mx = _mm256_max_epu16(v, sw);
+	mn = _mm256_min_epu16(v, sw);
+	v = _mm256_add_epi16(mx, _mm256_add_epi16(_mm256_srli_epi16(mn, 2),
+						_mm256_srli_epi16(mn, 3)));
+	return _mm256_and_si256(v, _mm256_set1_epi32(0xFFFF));
+}
+
+__attribute__((target("avx2")))
+static void envelope_cs16_avx2(const uint8_t *iq, size_t n, uint16_t *out)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		const __m256i *p = (const __m256i *) &iq[4 * i];
+		__m256i a = magnitude_cs16_avx2(_mm256_loadu_si256(p));
+		__m256i b = magnitude_cs16_avx2(_mm256_loadu_si256(p + 1));
+		// packus works per 128-bit lane, restore sample order
+		a = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i *) &out[i], a);
+	}
+	envelope_cs16_scalar(&iq[4 * i], n - i, &out[i]);
+}
+#endif
+
+static iq_envelope_fn_t envelope_select(enum iq_format format)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return format == IQ_FORMAT_CU8 ? envelope_cu8_avx2 :
+							envelope_cs16_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return format == IQ_FORMAT_CU8 ? envelope_cu8_sse2 :
+							envelope_cs16_sse2;
+#endif
+	return format == IQ_FORMAT_CU8 ? envelope_cu8_scalar :
+						envelope_cs16_scalar;
+}
+
+int iq_envelope_init(struct iq_envelope *env, const char *name)
+{
+	if (strcmp(name, "cu8") == 0) {
+		env->format = IQ_FORMAT_CU8;
+		env->sample_size = 2;
+	} else if (strcmp(name, "cs16") == 0) {
+		env->format = IQ_FORMAT_CS16;
+		env->sample_size = 4;
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+	env->envelope_block = envelope_select(env->format);
+
+	return 0;
+}
@@ -0,0 +1,78 @@
+/**
+ * iq_envelope.h - Envelope detection of complex IQ samples
+ *
+ * Converts raw IQ samples, as written by rtl_sdr and most other SDR tools, to
+ * AM levels that can be fed to the OOK slicer. The magnitude is approximated
+ * with alpha max plus beta min, max(|I|, |Q|) + 3/8 * min(|I|, |Q|), which is
+ * within 7% of the real magnitude and only needs shifts and adds.
+ *
+ * The levels use the scale of cs16 input, so a threshold works the same for
+ * both input formats. The largest level is 45056.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __IQ_ENVELOPE_H__
+#define __IQ_ENVELOPE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum iq_format {
+	IQ_FORMAT_CU8,		// Unsigned 8-bit I and Q, offset by 128
+	IQ_FORMAT_CS16,		// Signed 16-bit little-endian I and Q
+};
+
+typedef void (*iq_envelope_fn_t)(const uint8_t *iq, size_t n, uint16_t *out);
+
+struct iq_envelope {
+	enum iq_format format;
+	// Bytes per complex sample
+	size_t sample_size;
+	iq_envelope_fn_t envelope_block;
+};
+
+/**
+ * Initialize envelope detector
+ *
+ * @param name	Input format name: cu8 or cs16
+ *
+ * @returns	0 on success, -1 with errno set to EINVAL for unknown formats
+ */
+int iq_envelope_init(struct iq_envelope *env, const char *name);
+
+/**
+ * Determine the envelope of a block of samples
+ *
+ * @param iq	n complex samples of env->sample_size bytes each
+ * @param out	Receives n AM levels
+ */
+static inline void iq_envelope(const struct iq_envelope *env,
+				const uint8_t *iq, size_t n, uint16_t *out)
+{
+	env->envelope_block(iq, n, out);
+}
+
+#endif // __IQ_ENVELOPE_H__
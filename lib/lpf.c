@@ -0,0 +1,139 @@
+/**
+ * lpf.c - Low-pass filter for bit streams
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "lpf.h"
+
+#include <errno.h>
+
+int lpf_init(struct lpf *f, int depth, int low, int high)
+{
+	if (depth < 1 || depth > LPF_MAX_DEPTH ||
+	    low < 0 || high <= low || high > depth) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	f->depth = depth;
+	f->low = low;
+	f->high = high;
+	f->window = 0;
+	f->one_cnt = 0;
+	f->level = 0;
+
+	return 0;
+}
+
+/* Mask of bits from up to, but not including, to, counted from the MSB */
+static inline uint64_t range_mask(unsigned int from, unsigned int to)
+{
+	uint64_t mask = from == 64 ? 0 : ~0ULL >> from;
+
+	if (to < 64) {
+		mask &= ~(~0ULL >> to);
+	}
+	return mask;
+}
+
+void lpf_filter(struct lpf *f, uint64_t *words, size_t nbits)
+{
+	uint64_t depth_mask = f->depth == 64 ? ~0ULL : (1ULL << f->depth) - 1;
+	size_t w;
+
+	for (w = 0; w * 64 < nbits; w++) {
+		unsigned int n = nbits - w * 64 < 64 ? nbits - w * 64 : 64;
+		uint64_t n_mask = range_mask(0, n);
+		uint64_t in = words[w] & n_mask;
+		uint64_t out = 0;
+		unsigned int pos = 0;
+		int in_ones = __builtin_popcountll(in);
+		// Bits of the other level, and how many are needed to change
+		int other_cnt;
+		int change_cnt;
+
+		if (f->level) {
+			other_cnt = (f->depth - f->one_cnt) + ((int) n - in_ones);
+			change_cnt = f->depth - f->low;
+		} else {
+			other_cnt = f->one_cnt + in_ones;
+			change_cnt = f->high;
+		}
+
+		if (other_cnt < change_cnt) {
+			// Level can't change in this word
+			out = f->level ? n_mask : 0;
+			pos = n;
+		}
+
+		/*
+		 * The count only moves towards the other level on bits of the
+		 * other level, so only those bits can change the level. Jump
+		 * from one such bit to the next and count the bits of the
+		 * window ending at it.
+		 */
+		while (pos < n) {
+			uint64_t cand = (f->level ? ~in : in) & range_mask(pos, n);
+			unsigned int end = n;
+
+			while (cand != 0) {
+				unsigned int i = __builtin_clzll(cand);
+				uint64_t window = in >> (63 - i);
+				int cnt;
+
+				if (i + 1 < (unsigned int) f->depth) {
+					window |= f->window << (i + 1);
+				}
+				cnt = __builtin_popcountll(window & depth_mask);
+
+				if (f->level ? cnt <= f->low :
+						cnt >= f->high) {
+					end = i;
+					break;
+				}
+				cand &= ~(1ULL << (63 - i));
+			}
+
+			if (f->level) {
+				out |= range_mask(pos, end);
+			}
+			if (end < n) {
+				f->level = ! f->level;
+			}
+			pos = end;
+		}
+
+		words[w] = (words[w] & ~n_mask) | out;
+
+		if (n == 64) {
+			f->window = in & depth_mask;
+		} else {
+			f->window = ((f->window << n) | (in >> (64 - n))) &
+					depth_mask;
+		}
+		f->one_cnt = __builtin_popcountll(f->window);
+	}
+}
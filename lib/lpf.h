@@ -0,0 +1,87 @@
+/**
+ * lpf.h - Low-pass filter for bit streams
+ *
+ * Removes short glitches from a bit stream. The filter counts the set bits in a
+ * sliding window of depth bits. The level goes to 0 when at most low bits are
+ * set, and to 1 when at least high bits are set.
+ *
+ * The input is processed a word at a time. The level can only change on an
+ * input bit of the opposite level, so the window is only counted, with a
+ * popcount of the shifted input, at those bits and the runs in between are
+ * set at once. Words in which the window and the word together don't contain
+ * enough bits of the opposite level to change level are skipped without
+ * looking at the individual bits.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __LPF_H__
+#define __LPF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Default window size and levels, those of the original bit by bit filter
+#define LPF_DEPTH 9
+#define LPF_LOW 2
+#define LPF_HIGH 6
+#define LPF_MAX_DEPTH 64
+
+struct lpf {
+	int depth;
+	int low;
+	int high;
+
+	// Last depth input bits, newest in the LSB
+	uint64_t window;
+	int one_cnt;
+	int level;
+};
+
+/**
+ * Initialize filter
+ *
+ * The level before the first bit is assumed to be 0.
+ *
+ * @param depth		Window size in bits, 1 to LPF_MAX_DEPTH
+ * @param low		Level goes to 0 when at most low bits in the window are
+ *			set
+ * @param high		Level goes to 1 when at least high bits in the window
+ *			are set. Must be above low and at most depth.
+ *
+ * @returns	0 on success, -1 with errno set to EINVAL if the parameters
+ *		are out of range
+ */
+int lpf_init(struct lpf *f, int depth, int low, int high);
+
+/**
+ * Filter bits in place
+ *
+ * @param words		Bits, 64 per word with the first bit in the MSB
+ * @param nbits		Number of bits to filter
+ */
+void lpf_filter(struct lpf *f, uint64_t *words, size_t nbits);
+
+#endif // __LPF_H__
@@ -0,0 +1,588 @@
+/**
+ * ook_slicer.c - Threshold and down-sample AM levels to a bit stream
+ *
+ * The samples are first compared against the threshold in bulk, using SSE2 or
+ * AVX2 when the CPU supports it, giving a bit map with one bit per sample. This
+ * bit map is then reduced to one bit per down-sample window by counting the set
+ * bits in every window.
+ *
+ * In adaptive mode the threshold follows the signal. For every chunk of
+ * samples the maximum and mean level are determined, again using SIMD, and
+ * used to update a decaying peak level and noise floor estimate. The chunk is
+ * then sliced with a Schmitt trigger halfway between both levels. The trigger
+ * is applied to whole words by thresholding against the upper and lower level
+ * and propagating the last crossing with a parallel prefix scan.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ook_slicer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_SIMD
+# include <immintrin.h>
+#endif
+
+#define CHUNK_WORDS ((OOK_SLICER_CHUNK + 63) / 64)
+
+// Peak level decays by 1/2^PEAK_DECAY_SHIFT of the span per chunk
+#define PEAK_DECAY_SHIFT 4
+// Noise floor rises by 1/2^FLOOR_RISE_SHIFT of the difference per chunk
+#define FLOOR_RISE_SHIFT 6
+// Minimal peak level, relative to the noise floor, to be considered a signal
+#define MIN_PEAK_FACTOR 3
+
+/*
+ * Threshold kernels
+ *
+ * Compare a block of samples against the threshold and store the result as a
+ * bit map, 64 samples per word with the first sample in the MSB. The last word
+ * is padded with zero bits if n is not a multiple of 64.
+ */
+static void threshold_scalar(const uint16_t *vals, size_t n,
+				uint16_t threshold, uint64_t *bits)
+{
+	size_t i, k;
+	uint64_t w;
+
+	for (i = 0; i + 64 <= n; i += 64) {
+		w = 0;
+		for (k = 0; k < 64; k++) {
+			w = (w << 1) | (vals[i + k] > threshold);
+		}
+		bits[i / 64] = w;
+	}
+	if (i < n) {
+		w = 0;
+		for (k = 0; i + k < n; k++) {
+			w = (w << 1) | (vals[i + k] > threshold);
+		}
+		bits[i / 64] = w << (64 - k);
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/* Reverse the bit order of a word, movemask gives the first sample in bit 0 */
+static inline uint64_t bit_reverse64(uint64_t w)
+{
+	w = ((w >> 1) & 0x5555555555555555ULL) | ((w & 0x5555555555555555ULL) << 1);
+	w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+	w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	return __builtin_bswap64(w);
+}
+
+__attribute__((target("sse2")))
+static void threshold_sse2(const uint16_t *vals, size_t n,
+				uint16_t threshold, uint64_t *bits)
+{
+	// SSE2 only has a signed compare, so flip the sign bit of both sides
+	const __m128i bias = _mm_set1_epi16((short) 0x8000);
+	const __m128i thr = _mm_set1_epi16((short) (threshold ^ 0x8000));
+	size_t i;
+	int k;
+
+	for (i = 0; i + 64 <= n; i += 64) {
+		uint64_t w = 0;
+		for (k = 0; k < 4; k++) {
+			const __m128i *p = (const __m128i *) &vals[i + k * 16];
+			__m128i a = _mm_xor_si128(_mm_loadu_si128(p), bias);
+			__m128i b = _mm_xor_si128(_mm_loadu_si128(p + 1), bias);
+			a = _mm_cmpgt_epi16(a, thr);
+			b = _mm_cmpgt_epi16(b, thr);
+			w |= (uint64_t) _mm_movemask_epi8(_mm_packs_epi16(a, b))
+								<< (k * 16);
+		}
+		bits[i / 64] = bit_reverse64(w);
+	}
+	if (i < n) {
+		threshold_scalar(&vals[i], n - i, threshold, &bits[i / 64]);
+	}
+}
+
+__attribute__((target("avx2")))
+static void threshold_avx2(const uint16_t *vals, size_t n,
+				uint16_t threshold, uint64_t *bits)
+{
+	const __m256i bias = _mm256_set1_epi16((short) 0x8000);
+	const __m256i thr = _mm256_set1_epi16((short) (threshold ^ 0x8000));
+	size_t i;
+	int k;
+
+	for (i = 0; i + 64 <= n; i += 64) {
+		uint64_t w = 0;
+		for (k = 0; k < 2; k++) {
+			const __m256i *p = (const __m256i *) &vals[i + k * 32];
+			__m256i a = _mm256_xor_si256(_mm256_loadu_si256(p), bias);
+			__m256i b = _mm256_xor_si256(_mm256_loadu_si256(p + 1), bias);
+			a = _mm256_cmpgt_epi16(a, thr);
+			b = _mm256_cmpgt_epi16(b, thr);
+			// packs works per 128-bit lane, restore sample order
+			a = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+			w |= (uint64_t) (uint32_t) _mm256_movemask_epi8(a)
+								<< (k * 32);
+		}
+		bits[i / 64] = bit_reverse64(w);
+	}
+	if (i < n) {
+		threshold_scalar(&vals[i], n - i, threshold, &bits[i / 64]);
+	}
+}
+#endif
+
+/*
+ * Level statistics kernels
+ *
+ * Determine the maximum and the sum of a block of samples.
+ */
+static void stats_scalar(const uint16_t *vals, size_t n, uint16_t *max,
+				uint64_t *sum)
+{
+	uint16_t m = 0;
+	uint64_t acc = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (vals[i] > m)
+			m = vals[i];
+		acc += vals[i];
+	}
+
+	*max = m;
+	*sum = acc;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * The sums use psadbw on the low and high bytes of the samples separately,
+ * which adds up eight bytes into a 64-bit lane without overflow.
+ */
+__attribute__((target("sse2")))
+static void stats_sse2(const uint16_t *vals, size_t n, uint16_t *max,
+				uint64_t *sum)
+{
+	const __m128i bias = _mm_set1_epi16((short) 0x8000);
+	const __m128i low_mask = _mm_set1_epi16(0x00FF);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i m = bias;
+	__m128i acc_lo = zero;
+	__m128i acc_hi = zero;
+	uint16_t tmax;
+	uint64_t tsum;
+	uint64_t lo[2], hi[2];
+	uint16_t mlanes[8];
+	size_t i;
+	int k;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &vals[i]);
+		// Only a signed max, so flip the sign bit
+		m = _mm_max_epi16(m, _mm_xor_si128(v, bias));
+		acc_lo = _mm_add_epi64(acc_lo,
+				_mm_sad_epu8(_mm_and_si128(v, low_mask), zero));
+		acc_hi = _mm_add_epi64(acc_hi,
+				_mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+	}
+
+	_mm_storeu_si128((__m128i *) mlanes, _mm_xor_si128(m, bias));
+	_mm_storeu_si128((__m128i *) lo, acc_lo);
+	_mm_storeu_si128((__m128i *) hi, acc_hi);
+	stats_scalar(&vals[i], n - i, &tmax, &tsum);
+	for (k = 0; k < 8; k++) {
+		if (mlanes[k] > tmax)
+			tmax = mlanes[k];
+	}
+
+	*max = tmax;
+	*sum = tsum + lo[0] + lo[1] + ((hi[0] + hi[1]) << 8);
+}
+
+__attribute__((target("avx2")))
+static void stats_avx2(const uint16_t *vals, size_t n, uint16_t *max,
+				uint64_t *sum)
+{
+	const __m256i low_mask = _mm256_set1_epi16(0x00FF);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i m = zero;
+	__m256i acc_lo = zero;
+	__m256i acc_hi = zero;
+	uint16_t tmax;
+	uint64_t tsum;
+	uint64_t lo[4], hi[4];
+	uint16_t mlanes[16];
+	size_t i;
+	int k;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) &vals[i]);
+		m = _mm256_max_epu16(m, v);
+		acc_lo = _mm256_add_epi64(acc_lo,
+			_mm256_sad_epu8(_mm256_and_si256(v, low_mask), zero));
+		acc_hi = _mm256_add_epi64(acc_hi,
+			_mm256_sad_epu8(_mm256_srli_epi16(v, 8), zero));
+	}
+
+	_mm256_storeu_si256((__m256i *) mlanes, m);
+	_mm256_storeu_si256((__m256i *) lo, acc_lo);
+	_mm256_storeu_si256((__m256i *) hi, acc_hi);
+	stats_scalar(&vals[i], n - i, &tmax, &tsum);
+	for (k = 0; k < 16; k++) {
+		if (mlanes[k] > tmax)
+			tmax = mlanes[k];
+	}
+
+	*max = tmax;
+	*sum = tsum + lo[0] + lo[1] + lo[2] + lo[3] +
+		((hi[0] + hi[1] + hi[2] + hi[3]) << 8);
+}
+#endif
+
+static ook_stats_fn_t stats_select(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return stats_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return stats_sse2;
+#endif
+	return stats_scalar;
+}
+
+static ook_threshold_fn_t threshold_select(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return threshold_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return threshold_sse2;
+#endif
+	return threshold_scalar;
+}
+
+/* Count the set bits in bit map range [start, start + len) */
+static unsigned int bitmap_count(const uint64_t *bits, size_t start, size_t len)
+{
+	unsigned int cnt = 0;
+
+	while (len > 0) {
+		size_t off = start & 63;
+		size_t take = 64 - off;
+		if (take > len)
+			take = len;
+		cnt += __builtin_popcountll((bits[start / 64] << off) >> (64 - take));
+		start += take;
+		len -= take;
+	}
+
+	return cnt;
+}
+
+
+void ook_slicer_init(struct ook_slicer *s, uint16_t threshold,
+			int downsample_rate)
+{
+	s->threshold = threshold;
+	s->downsample_rate = downsample_rate;
+	s->downsample_threshold = 1;
+	if (downsample_rate != 1) {
+		s->downsample_threshold = downsample_rate >> 1;
+	}
+	s->threshold_block = threshold_select();
+
+	s->adaptive = false;
+	s->stats_block = NULL;
+
+	s->gate_min = 0;
+	s->gate_hold = 0;
+	s->gate_left = 0;
+
+	s->downsample_cnt = 0;
+	s->one_cnt = 0;
+	s->word = 0;
+	s->word_bits = 0;
+}
+
+void ook_slicer_set_adaptive(struct ook_slicer *s, int hysteresis)
+{
+	s->adaptive = true;
+	s->hysteresis = hysteresis;
+	s->stats_block = stats_select();
+	s->have_levels = false;
+	s->trigger_state = 0;
+}
+
+void ook_slicer_set_gate(struct ook_slicer *s, unsigned int min_count,
+				unsigned int hold)
+{
+	s->gate_min = min_count;
+	s->gate_hold = hold;
+	s->gate_left = 0;
+}
+
+/*
+ * Update the level estimates with the statistics of a chunk and derive the
+ * thresholds of the Schmitt trigger from them
+ */
+static void adapt_threshold(struct ook_slicer *s, const uint16_t *vals,
+				size_t n)
+{
+	uint16_t max;
+	uint64_t sum;
+	uint32_t mean;
+	uint32_t span;
+	uint32_t center;
+	uint32_t hyst;
+
+	s->stats_block(vals, n, &max, &sum);
+	mean = sum / n;
+
+	if (! s->have_levels) {
+		s->floor_level = mean;
+		s->peak_level = max;
+		s->have_levels = true;
+	}
+
+	// Fast attack, slow decay
+	if (max >= s->peak_level) {
+		s->peak_level = max;
+	} else {
+		s->peak_level -= (s->peak_level - s->floor_level) >> PEAK_DECAY_SHIFT;
+	}
+
+	// Only follow rising noise on chunks without signal
+	if (mean < s->floor_level) {
+		s->floor_level = mean;
+	} else if (max < s->threshold) {
+		s->floor_level += (mean - s->floor_level) >> FLOOR_RISE_SHIFT;
+	}
+
+	if (s->peak_level < s->floor_level * MIN_PEAK_FACTOR ||
+	    s->peak_level == s->floor_level)
+	{
+		// Just noise, keep the output low
+		s->threshold = UINT16_MAX;
+		s->threshold_low = UINT16_MAX;
+		return;
+	}
+
+	span = s->peak_level - s->floor_level;
+	center = s->floor_level + span / 2;
+	hyst = span * s->hysteresis / 200;
+	s->threshold = center + hyst;
+	s->threshold_low = center - hyst;
+}
+
+/*
+ * Schmitt trigger on whole words
+ *
+ * Samples above the upper threshold (set) switch the level to 1, samples not
+ * above the lower threshold (reset) switch it to 0. Other samples keep the
+ * level of the last set or reset before them, which is found by a prefix scan
+ * over the word in log2(64) steps. Samples without any set or reset before
+ * them in the word take over the level from the previous word.
+ */
+static void schmitt_trigger(uint64_t *high, const uint64_t *low, size_t n,
+				int *state)
+{
+	size_t i;
+	int sh;
+
+	for (i = 0; i < n; i += 64) {
+		uint64_t known = high[i / 64] | ~low[i / 64];
+		uint64_t level = high[i / 64];
+
+		for (sh = 1; sh < 64; sh <<= 1) {
+			level |= (level >> sh) & ~known;
+			known |= known >> sh;
+		}
+		if (*state)
+			level |= ~known;
+
+		if (n - i < 64) {
+			*state = (level >> (64 - (n - i))) & 1;
+			level &= ~(~0ULL >> (n - i));
+		} else {
+			*state = level & 1;
+		}
+		high[i / 64] = level;
+	}
+}
+
+/* Append nbits bits, MSB aligned in w with the other bits zero */
+static inline size_t put_bits(struct ook_slicer *s, uint64_t w, int nbits,
+				uint64_t *out)
+{
+	s->word |= w >> s->word_bits;
+	s->word_bits += nbits;
+	if (s->word_bits < 64)
+		return 0;
+
+	*out = s->word;
+	s->word_bits -= 64;
+	s->word = (s->word_bits == 0) ? 0 : w << (nbits - s->word_bits);
+	return 1;
+}
+
+static size_t slice_chunk(struct ook_slicer *s, const uint64_t *bits, size_t n,
+				uint64_t *out)
+{
+	size_t o = 0;
+	size_t p = 0;
+
+	if (s->downsample_rate == 1) {
+		for (p = 0; p + 64 <= n; p += 64) {
+			o += put_bits(s, bits[p / 64], 64, &out[o]);
+		}
+		if (p < n) {
+			o += put_bits(s, bits[p / 64], n - p, &out[o]);
+		}
+		return o;
+	}
+
+	while (p < n) {
+		size_t take = s->downsample_rate - s->downsample_cnt;
+		if (take > n - p)
+			take = n - p;
+		s->one_cnt += bitmap_count(bits, p, take);
+		s->downsample_cnt += take;
+		p += take;
+		if (s->downsample_cnt == s->downsample_rate) {
+			uint64_t bit = (s->one_cnt >= s->downsample_threshold);
+			o += put_bits(s, bit << 63, 1, &out[o]);
+			s->one_cnt = 0;
+			s->downsample_cnt = 0;
+		}
+	}
+
+	return o;
+}
+
+/* Like slice_chunk() for n samples that are all '0' */
+static size_t slice_idle(struct ook_slicer *s, size_t n, uint64_t *out)
+{
+	size_t o = 0;
+	size_t nbits;
+	size_t take;
+
+	// Complete the partial down-sample window
+	if (s->downsample_cnt != 0) {
+		take = s->downsample_rate - s->downsample_cnt;
+		if (take > n)
+			take = n;
+		s->downsample_cnt += take;
+		n -= take;
+		if (s->downsample_cnt == s->downsample_rate) {
+			uint64_t bit = (s->one_cnt >= s->downsample_threshold);
+			o += put_bits(s, bit << 63, 1, &out[o]);
+			s->one_cnt = 0;
+			s->downsample_cnt = 0;
+		}
+	}
+
+	for (nbits = n / s->downsample_rate; nbits > 0; nbits -= take) {
+		take = nbits > 64 ? 64 : nbits;
+		o += put_bits(s, 0, take, &out[o]);
+	}
+	s->downsample_cnt += n % s->downsample_rate;
+
+	return o;
+}
+
+/*
+ * Decide whether a thresholded chunk is active, see ook_slicer_set_gate()
+ *
+ * Chunks without any sample above the threshold are never active, those are
+ * handled by slice_idle() which gives the same output.
+ */
+static bool gate_chunk(struct ook_slicer *s, const uint64_t *bits, size_t n)
+{
+	unsigned int cnt = 0;
+	bool last = (bits[(n - 1) / 64] >> (63 - ((n - 1) & 63))) & 1;
+	size_t i;
+
+	for (i = 0; i < (n + 63) / 64; i++) {
+		cnt += __builtin_popcountll(bits[i]);
+	}
+	// All '0' chunks take the fast path, even without gate
+	if (cnt == 0) {
+		if (s->gate_left > 0)
+			s->gate_left--;
+		return false;
+	}
+
+	if (last || cnt >= s->gate_min) {
+		s->gate_left = s->gate_hold;
+		return true;
+	}
+	if (s->gate_left > 0) {
+		s->gate_left--;
+		return true;
+	}
+	return false;
+}
+
+size_t ook_slicer_push(struct ook_slicer *s, const uint16_t *vals, size_t n,
+			uint64_t *out)
+{
+	uint64_t bits[CHUNK_WORDS];
+	uint64_t bits_low[CHUNK_WORDS];
+	size_t o = 0;
+	size_t i;
+
+	for (i = 0; i < n; i += OOK_SLICER_CHUNK) {
+		size_t cnt = n - i;
+		if (cnt > OOK_SLICER_CHUNK)
+			cnt = OOK_SLICER_CHUNK;
+		if (s->adaptive) {
+			adapt_threshold(s, &vals[i], cnt);
+			s->threshold_block(&vals[i], cnt, s->threshold, bits);
+			s->threshold_block(&vals[i], cnt, s->threshold_low,
+						bits_low);
+			schmitt_trigger(bits, bits_low, cnt, &s->trigger_state);
+		} else {
+			s->threshold_block(&vals[i], cnt, s->threshold, bits);
+		}
+		if (gate_chunk(s, bits, cnt)) {
+			o += slice_chunk(s, bits, cnt, &out[o]);
+		} else {
+			s->trigger_state = 0;
+			o += slice_idle(s, cnt, &out[o]);
+		}
+	}
+
+	return o;
+}
+
+int ook_slicer_flush(struct ook_slicer *s, uint64_t *word)
+{
+	int nbits = s->word_bits;
+
+	*word = s->word;
+	s->word = 0;
+	s->word_bits = 0;
+
+	return nbits;
+}
@@ -0,0 +1,146 @@
+/**
+ * ook_slicer.h - Threshold and down-sample AM levels to a bit stream
+ *
+ * Converts AM sample levels into a stream of bits by comparing every sample
+ * against a threshold and down-sampling the result. Bits are returned as 64-bit
+ * words with the first bit in the MSB, so storing a word big-endian gives the
+ * packed bit stream format used throughout this repository.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __OOK_SLICER_H__
+#define __OOK_SLICER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of samples ook_slicer_push() thresholds in one go */
+#define OOK_SLICER_CHUNK 2048
+
+typedef void (*ook_threshold_fn_t)(const uint16_t *vals, size_t n,
+				uint16_t threshold, uint64_t *bits);
+typedef void (*ook_stats_fn_t)(const uint16_t *vals, size_t n, uint16_t *max,
+				uint64_t *sum);
+
+struct ook_slicer {
+	uint16_t threshold;
+	int downsample_rate;
+	unsigned int downsample_threshold;
+	ook_threshold_fn_t threshold_block;
+
+	// Adaptive threshold
+	bool adaptive;
+	int hysteresis;
+	ook_stats_fn_t stats_block;
+	bool have_levels;
+	uint32_t floor_level;
+	uint32_t peak_level;
+	uint16_t threshold_low;
+	int trigger_state;
+
+	// Activity gate
+	unsigned int gate_min;
+	unsigned int gate_hold;
+	unsigned int gate_left;
+
+	// Partial down-sample window
+	int downsample_cnt;
+	unsigned int one_cnt;
+
+	// Partial output word
+	uint64_t word;
+	int word_bits;
+};
+
+/**
+ * Initialize slicer
+ *
+ * @param s			Slicer to initialize
+ * @param threshold		Level above which a sample is considered '1'
+ * @param downsample_rate	Number of samples per output bit
+ */
+void ook_slicer_init(struct ook_slicer *s, uint16_t threshold,
+			int downsample_rate);
+
+/**
+ * Let the threshold follow the signal
+ *
+ * The noise floor and peak level are estimated once per OOK_SLICER_CHUNK
+ * samples, the threshold is set halfway. Once a sample is above the threshold
+ * the level only changes back to '0' below the threshold minus the
+ * hysteresis.
+ *
+ * @param hysteresis	Hysteresis in percent of the distance between noise
+ *			floor and peak level
+ */
+void ook_slicer_set_adaptive(struct ook_slicer *s, int hysteresis);
+
+/**
+ * Output idle chunks as '0'
+ *
+ * Most of the time a receiver only sees noise, of which the occasional sample
+ * above the threshold causes a lot of work downstream. A chunk of
+ * OOK_SLICER_CHUNK samples with fewer than min_count samples above the
+ * threshold is considered idle and output as all '0'. The number of output
+ * bits doesn't change, so sample positions downstream stay correct.
+ *
+ * A chunk is never idle if its last sample is above the threshold, so the
+ * start of a pulse is kept, or within hold chunks after an active chunk, so
+ * the end of a transmission is kept.
+ *
+ * @param min_count	Minimal number of samples above the threshold in an
+ *			active chunk, 0 to disable the gate
+ * @param hold		Number of chunks kept after an active chunk
+ */
+void ook_slicer_set_gate(struct ook_slicer *s, unsigned int min_count,
+				unsigned int hold);
+
+/**
+ * Slice a block of samples
+ *
+ * Every completed output word is written to out, which must have room for
+ * ook_slicer_max_words(n) words. Bits that don't fill a complete word are kept
+ * until the next call.
+ *
+ * @returns	The number of words written to out
+ */
+size_t ook_slicer_push(struct ook_slicer *s, const uint16_t *vals, size_t n,
+			uint64_t *out);
+
+/**
+ * Get the bits of the last, partial, output word
+ *
+ * @returns	The number of valid bits in *word, may be 0
+ */
+int ook_slicer_flush(struct ook_slicer *s, uint64_t *word);
+
+static inline size_t ook_slicer_max_words(size_t n)
+{
+	return n / 64 + 1;
+}
+
+#endif // __OOK_SLICER_H__
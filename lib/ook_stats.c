@@ -0,0 +1,249 @@
+/**
+ * ook_stats.c - Streaming statistics of AM levels
+ *
+ * Counting the levels is the only per sample work. Min, max, mean, variance and
+ * the Otsu threshold are all computed from the histogram when printing, which
+ * costs a fixed amount of work independent of the amount of samples.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ook_stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fold sub histograms before their 32-bit counters can overflow
+#define SUB_HIST_MAX_COUNT (1ULL << 31)
+
+static void pulse_cb(void *arg, int new_level, uint64_t len)
+{
+	struct ook_stats *st = (struct ook_stats *) arg;
+	int bucket;
+
+	if (len == 0)
+		return;
+
+	bucket = 63 - __builtin_clzll(len);
+	if (bucket >= OOK_STATS_PULSE_BUCKETS)
+		bucket = OOK_STATS_PULSE_BUCKETS - 1;
+	st->pulses[!new_level][bucket]++;
+}
+
+struct ook_stats *ook_stats_new(void)
+{
+	struct ook_stats *st;
+
+	if ((st = calloc(1, sizeof(*st))) == NULL)
+		return NULL;
+	edge_scan_init(&st->es, pulse_cb, st);
+
+	return st;
+}
+
+void ook_stats_free(struct ook_stats *st)
+{
+	free(st);
+}
+
+void ook_stats_reset(struct ook_stats *st)
+{
+	memset(st->sub_hist, 0, sizeof(st->sub_hist));
+	memset(st->hist, 0, sizeof(st->hist));
+	st->sub_count = 0;
+	st->nsamples = 0;
+	st->nbits = 0;
+	st->ones = 0;
+	memset(st->pulses, 0, sizeof(st->pulses));
+}
+
+static void fold_sub_hist(struct ook_stats *st)
+{
+	size_t i;
+	int k;
+
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < OOK_STATS_LEVELS; i++) {
+			st->hist[i] += st->sub_hist[k][i];
+		}
+	}
+	memset(st->sub_hist, 0, sizeof(st->sub_hist));
+	st->sub_count = 0;
+}
+
+void ook_stats_add_samples(struct ook_stats *st, const uint16_t *vals,
+				size_t n)
+{
+	size_t i;
+
+	if (st->sub_count + n > SUB_HIST_MAX_COUNT) {
+		fold_sub_hist(st);
+	}
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		st->sub_hist[0][vals[i]]++;
+		st->sub_hist[1][vals[i + 1]]++;
+		st->sub_hist[2][vals[i + 2]]++;
+		st->sub_hist[3][vals[i + 3]]++;
+	}
+	for (; i < n; i++) {
+		st->sub_hist[0][vals[i]]++;
+	}
+
+	st->sub_count += n;
+	st->nsamples += n;
+}
+
+void ook_stats_add_bits(struct ook_stats *st, const uint64_t *words,
+				size_t nbits)
+{
+	size_t i;
+
+	for (i = 0; i + 64 <= nbits; i += 64) {
+		st->ones += __builtin_popcountll(words[i / 64]);
+	}
+	if (i < nbits) {
+		st->ones += __builtin_popcountll(words[i / 64] &
+						~(~0ULL >> (nbits - i)));
+	}
+	st->nbits += nbits;
+
+	edge_scan_push(&st->es, words, nbits);
+}
+
+/*
+ * Otsu's method: the threshold that maximizes the variance between the levels
+ * below and above it
+ */
+static unsigned int otsu_threshold(const uint64_t *hist, uint64_t total)
+{
+	double sum_all = 0;
+	double sum_low = 0;
+	double best = -1;
+	uint64_t cnt_low = 0;
+	unsigned int best_t = 0;
+	unsigned int best_end = 0;
+	unsigned int t;
+
+	for (t = 0; t < OOK_STATS_LEVELS; t++) {
+		sum_all += (double) t * hist[t];
+	}
+
+	for (t = 0; t < OOK_STATS_LEVELS; t++) {
+		double mean_low, mean_high, between;
+
+		cnt_low += hist[t];
+		sum_low += (double) t * hist[t];
+		if (cnt_low == 0)
+			continue;
+		if (cnt_low == total)
+			break;
+
+		mean_low = sum_low / cnt_low;
+		mean_high = (sum_all - sum_low) / (total - cnt_low);
+		between = (double) cnt_low * (total - cnt_low) *
+				(mean_low - mean_high) * (mean_low - mean_high);
+		if (between > best) {
+			best = between;
+			best_t = t;
+			best_end = t;
+		} else if (between == best) {
+			// Levels between both classes, use the middle
+			best_end = t;
+		}
+	}
+
+	return (best_t + best_end) / 2;
+}
+
+void ook_stats_print(struct ook_stats *st, FILE *fp, const char *slicer_desc)
+{
+	unsigned int min_unsigned = 0, max_unsigned = 0;
+	int min_signed = 0, max_signed = 0;
+	double mean = 0, var = 0;
+	unsigned int i;
+	int k;
+
+	fold_sub_hist(st);
+
+	fprintf(fp, "Analysis\n");
+	fprintf(fp, "--------\n");
+	fprintf(fp, "Samples: %ju\n", (uintmax_t) st->nsamples);
+	if (st->nsamples == 0)
+		return;
+
+	for (i = 0; i < OOK_STATS_LEVELS && st->hist[i] == 0; i++)
+		;
+	min_unsigned = i;
+	for (i = OOK_STATS_LEVELS - 1; i > 0 && st->hist[i] == 0; i--)
+		;
+	max_unsigned = i;
+
+	// As signed, 0x8000-0xFFFF are the negative values
+	for (i = 0x8000; i < OOK_STATS_LEVELS && st->hist[i] == 0; i++)
+		;
+	min_signed = (i < OOK_STATS_LEVELS) ? (int) i - 0x10000 : (int) min_unsigned;
+	for (i = 0x7FFF; i > 0 && st->hist[i] == 0; i--)
+		;
+	max_signed = (st->hist[i] != 0) ? (int) i : (int) max_unsigned - 0x10000;
+
+	for (i = 0; i < OOK_STATS_LEVELS; i++) {
+		mean += (double) i * st->hist[i];
+	}
+	mean /= st->nsamples;
+	for (i = 0; i < OOK_STATS_LEVELS; i++) {
+		var += ((double) i - mean) * ((double) i - mean) * st->hist[i];
+	}
+	var /= st->nsamples;
+
+	fprintf(fp, "Unsigned Minimal level: %u\n", min_unsigned);
+	fprintf(fp, "Unsigned Maximum level: %u\n", max_unsigned);
+	fprintf(fp, "Signed Minimal level: %d\n", min_signed);
+	fprintf(fp, "Signed Maximum level: %d\n", max_signed);
+	fprintf(fp, "Mean level: %.1f\n", mean);
+	fprintf(fp, "Standard deviation: %.1f\n", sqrt(var));
+	fprintf(fp, "Suggested threshold (Otsu): %u\n",
+			otsu_threshold(st->hist, st->nsamples));
+
+	if (st->nbits == 0)
+		return;
+
+	fprintf(fp, "Duty cycle (%s): %.2f%%\n", slicer_desc,
+			100.0 * st->ones / st->nbits);
+	fprintf(fp, "Pulse lengths in output bits:\n");
+	fprintf(fp, "  %-21s %12s %12s\n", "length", "high", "low");
+	for (k = 0; k < OOK_STATS_PULSE_BUCKETS; k++) {
+		char range[32];
+
+		if (st->pulses[0][k] == 0 && st->pulses[1][k] == 0)
+			continue;
+		snprintf(range, sizeof(range), "%ju-%ju",
+				(uintmax_t) 1 << k, ((uintmax_t) 2 << k) - 1);
+		fprintf(fp, "  %-21s %12ju %12ju\n", range,
+				(uintmax_t) st->pulses[1][k],
+				(uintmax_t) st->pulses[0][k]);
+	}
+}
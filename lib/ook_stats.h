@@ -0,0 +1,93 @@
+/**
+ * ook_stats.h - Streaming statistics of AM levels
+ *
+ * Collects statistics of AM levels and of the bit stream sliced from them in a
+ * single pass: a histogram of all 16-bit levels, from which the minimum,
+ * maximum, mean, variance and a suggested threshold are derived, and the duty
+ * cycle and a histogram of the pulse lengths of the sliced bit stream.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __OOK_STATS_H__
+#define __OOK_STATS_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "edge_scan.h"
+
+#define OOK_STATS_LEVELS 65536
+// Pulse lengths are counted in power of 2 buckets
+#define OOK_STATS_PULSE_BUCKETS 32
+
+struct ook_stats {
+	// Histograms are split in four to avoid dependencies between updates
+	uint32_t sub_hist[4][OOK_STATS_LEVELS];
+	uint64_t sub_count;
+	uint64_t hist[OOK_STATS_LEVELS];
+	uint64_t nsamples;
+
+	uint64_t nbits;
+	uint64_t ones;
+	uint64_t pulses[2][OOK_STATS_PULSE_BUCKETS];
+	struct edge_scan es;
+};
+
+/**
+ * Allocate statistics
+ *
+ * @returns	New statistics, or NULL if out of memory
+ */
+struct ook_stats *ook_stats_new(void);
+
+void ook_stats_free(struct ook_stats *st);
+
+/**
+ * Clear all statistics
+ *
+ * The level of the sliced bit stream is remembered, so pulses that are longer
+ * than the reporting interval are still counted correctly.
+ */
+void ook_stats_reset(struct ook_stats *st);
+
+/* Add samples to the level histogram */
+void ook_stats_add_samples(struct ook_stats *st, const uint16_t *vals,
+				size_t n);
+
+/* Add sliced bits to the duty cycle and pulse length histogram */
+void ook_stats_add_bits(struct ook_stats *st, const uint64_t *words,
+				size_t nbits);
+
+/**
+ * Print summary
+ *
+ * @param slicer_desc	Description of the slicer settings, printed with
+ *			the duty cycle
+ */
+void ook_stats_print(struct ook_stats *st, FILE *fp, const char *slicer_desc);
+
+#endif // __OOK_STATS_H__
@@ -0,0 +1,457 @@
+/**
+ * somfy.c - Somfy RTS frame decoding
+ *
+ * The decoder expects one sample per ~36 us, see decode_somfy.c for how to
+ * obtain such a bit stream.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "somfy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "somfy_hosts.h"
+
+/*
+ * Pulse length ranges in microseconds at the nominal symbol time. These match
+ * 64..72, 127..133, 30..40 and 10..25 samples at 36 us per sample.
+ *
+ * idle -> preamble: new_level = 0 & len == hardware sync
+ * preamble -> data0: new_level = 0 & len == software sync
+ * preamble -> preamble: len == hardware sync
+ * data0 -> data0: len == symbol
+ * data0 -> data1: len == half symbol
+ * data1 -> data0: len == half symbol
+ * else -> idle
+ */
+#define HW_SYNC_MIN 2304
+#define HW_SYNC_MAX 2592
+#define SW_SYNC_MIN 4572
+#define SW_SYNC_MAX 4788
+#define SYMBOL_MIN 1080
+#define SYMBOL_MAX 1440
+#define HALF_SYMBOL_MIN 360
+#define HALF_SYMBOL_MAX 900
+
+// Classifier table entries: next state in the low bits, plus actions
+#define ENTRY_STATE_MASK 0x03
+#define ENTRY_END 0x04		// End of data, report frame
+#define ENTRY_START 0x08	// Start of data
+#define ENTRY_BIT 0x10		// Shift in new level as data bit
+#define ENTRY_PREAMBLE 0x20	// Start of preamble
+
+uint8_t somfy_frame_get_encryption_key(somfy_frame_t frame) {
+	return (frame >> (6*8)) & 0xFF;
+}
+
+uint8_t somfy_frame_get_control(somfy_frame_t frame) {
+	return (frame >> (5*8 + 4)) & 0xF;
+}
+
+uint8_t somfy_frame_get_chksum(somfy_frame_t frame) {
+	return (frame >> (5*8)) & 0xF;
+}
+
+uint16_t somfy_frame_get_rolling_code(somfy_frame_t frame) {
+	return (frame >> (3*8)) & 0xFFFF;
+}
+
+uint32_t somfy_frame_get_addr(somfy_frame_t frame) {
+	return ((frame & 0xFF) << 16) | (frame & 0xFF00) | ((frame & 0xFF0000) >> 16);
+}
+
+uint8_t somfy_calc_checksum(somfy_frame_t frame) {
+	int checksum=0;
+	int i;
+	for (i=0; i < 14; i++) {
+		checksum ^= frame & 0xf;
+		frame = frame >> 4;
+	}
+
+	return checksum;
+}
+
+somfy_frame_t somfy_frame_new(uint8_t key, uint8_t control,
+				uint16_t rolling_code, uint32_t addr) {
+	somfy_frame_t frame;
+
+	frame = ((uint64_t) key << (6*8)) |
+		((uint64_t) (control & 0xF) << (5*8 + 4)) |
+		((uint64_t) rolling_code << (3*8)) |
+		((addr & 0xFF) << 16) | (addr & 0xFF00) | ((addr >> 16) & 0xFF);
+
+	return frame | ((uint64_t) somfy_calc_checksum(frame) << (5*8));
+}
+
+somfy_frame_t somfy_frame_obfuscate(somfy_frame_t frame) {
+	int i;
+
+	// Start at the second byte, every byte uses the already obfuscated one
+	for (i = 5; i >= 0; i--) {
+		frame ^= (frame >> 8) & (0xFFULL << (i*8));
+	}
+
+	return frame;
+}
+
+const char *somfy_frame_get_control_name(somfy_frame_t frame) {
+	static const char *names[16] = {
+		"c0",
+		"MY",
+		"UP",
+		"MY+UP",
+		"DOWN",
+		"MY+DOWN",
+		"UP+DOWN",
+		"c7",
+		"PROG",
+		"SUN+FLAG",
+		"FLAG",
+		"c11",
+		"c12",
+		"c13",
+		"c14",
+		"c15"
+	};
+	
+	return names[somfy_frame_get_control(frame)];
+}
+
+void somfy_print_event_long(FILE *fp, const struct somfy_event *ev,
+				int numeric)
+{
+	somfy_frame_t frame = ev->frame;
+	uint8_t checksum = 0;
+
+	fprintf(fp, "%.14jx:\n", (uintmax_t) frame);
+
+	checksum = somfy_calc_checksum(frame);
+	if (checksum == 0) {
+		uint32_t addr;
+		const char *name;
+
+		fprintf(fp, "checksum = OK\n");
+		fprintf(fp, "Encryption Key = %.2x\n", somfy_frame_get_encryption_key(frame));
+		fprintf(fp, "Control=%.2x", somfy_frame_get_control(frame));
+		if (! numeric) {
+			fprintf(fp, " (%s)", somfy_frame_get_control_name(frame)); 
+		}
+		fprintf(fp, ", ");
+		fprintf(fp, "Rolling Code = %.4x\n", somfy_frame_get_rolling_code(frame));
+		
+		addr = somfy_frame_get_addr(frame);
+		fprintf(fp, "Address = %.6x", addr);
+		if (! numeric) {
+			int slot = somfy_hosts_read_begin();
+			if ((name = somfy_addr_to_name(addr)) != NULL) {
+				fprintf(fp, " (%s)", name);
+			}
+			somfy_hosts_read_end(slot);
+		}
+		fputc('\n', fp);
+		if (ev->repeats > 0) {
+			fprintf(fp, "Repeats = %u\n", ev->repeats);
+		}
+		if (ev->regress) {
+			fprintf(fp, "WARNING: Rolling Code not increased, last = %.4x\n",
+					ev->last_rolling_code);
+		}
+	} else {
+		fprintf(fp, "checksum = FAILED (%.2x)\n", checksum);
+	}
+	fprintf(fp, "--------------------------------------------------------------------------------\n");
+}
+
+void somfy_print_event_oneline(FILE *fp, const struct somfy_event *ev,
+				int numeric)
+{
+	somfy_frame_t frame = ev->frame;
+	uint8_t checksum = 0;
+
+	fprintf(fp, "%.14jx: ", (uintmax_t) frame);
+
+	checksum = somfy_calc_checksum(frame);
+	if (checksum == 0) {
+		uint32_t addr;
+		const char *name;
+
+		fprintf(fp, "checksum=OK, ");
+		fprintf(fp, "Encryption Key=%.2x, ", somfy_frame_get_encryption_key(frame));
+		fprintf(fp, "Control=%.2x", somfy_frame_get_control(frame));
+		if (! numeric) {
+			fprintf(fp, "(%s)", somfy_frame_get_control_name(frame)); 
+		}
+		fprintf(fp, ", ");
+		fprintf(fp, "Rolling Code=%.4x, ", somfy_frame_get_rolling_code(frame));
+		
+		addr = somfy_frame_get_addr(frame);
+		fprintf(fp, "Address=%.6x", addr);
+		if (! numeric) {
+			int slot = somfy_hosts_read_begin();
+			if ((name = somfy_addr_to_name(addr)) != NULL) {
+				fprintf(fp, "(%s)", name);
+			}
+			somfy_hosts_read_end(slot);
+		}
+		if (ev->repeats > 0) {
+			fprintf(fp, ", Repeats=%u", ev->repeats);
+		}
+		if (ev->regress) {
+			fprintf(fp, ", Rolling Code Regression(last=%.4x)",
+					ev->last_rolling_code);
+		}
+		fputc('\n', fp);
+	} else {
+		fprintf(fp, "checksum=FAILED(%.2x)\n", checksum);
+	}
+}
+
+void somfy_print_frame_long(FILE *fp, somfy_frame_t frame, int numeric)
+{
+	struct somfy_event ev = { .frame = frame };
+
+	somfy_print_event_long(fp, &ev, numeric);
+}
+
+void somfy_print_frame_oneline(FILE *fp, somfy_frame_t frame, int numeric)
+{
+	struct somfy_event ev = { .frame = frame };
+
+	somfy_print_event_oneline(fp, &ev, numeric);
+}
+
+/* Convert pulse length in microseconds to samples */
+static uint32_t us_to_samples(uint32_t us, uint32_t sample_rate,
+				uint32_t symbol_time)
+{
+	uint64_t scaled = (uint64_t) us * symbol_time * sample_rate;
+	uint64_t div = (uint64_t) SOMFY_SYMBOL_TIME * 1000000;
+
+	return (scaled + div / 2) / div;
+}
+
+/* Next state of the decoder, the reference the table is built from */
+static enum somfy_state classify(const uint32_t *r, enum somfy_state state,
+					int new_level, uint32_t len)
+{
+#define IN_RANGE(i) (len >= r[(i) * 2] && len <= r[(i) * 2 + 1])
+	switch (state) {
+	case SOMFY_IDLE:
+		if (new_level == 0 && IN_RANGE(0))
+			return SOMFY_PREAMBLE;
+		break;
+	case SOMFY_PREAMBLE:
+		if (new_level == 0 && IN_RANGE(1))
+			return SOMFY_DATA0;
+		if (IN_RANGE(0))
+			return SOMFY_PREAMBLE;
+		break;
+	case SOMFY_DATA0:
+		if (IN_RANGE(2))
+			return SOMFY_DATA0;
+		if (IN_RANGE(3))
+			return SOMFY_DATA1;
+		break;
+	case SOMFY_DATA1:
+		if (IN_RANGE(3))
+			return SOMFY_DATA0;
+		break;
+	}
+	return SOMFY_IDLE;
+#undef IN_RANGE
+}
+
+int somfy_classifier_init(struct somfy_classifier *cls, uint32_t sample_rate,
+				uint32_t symbol_time)
+{
+	static const uint32_t ranges_us[8] = {
+		HW_SYNC_MIN, HW_SYNC_MAX,
+		SW_SYNC_MIN, SW_SYNC_MAX,
+		SYMBOL_MIN, SYMBOL_MAX,
+		HALF_SYMBOL_MIN, HALF_SYMBOL_MAX,
+	};
+	uint32_t r[8];
+	uint32_t len;
+	int state;
+	int level;
+	int i;
+
+	if (sample_rate == 0 || symbol_time == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	cls->max_len = 0;
+	for (i = 0; i < 8; i++) {
+		r[i] = us_to_samples(ranges_us[i], sample_rate, symbol_time);
+		if (r[i] > cls->max_len)
+			cls->max_len = r[i];
+	}
+	// All longer pulses are classified the same as max_len + 1
+	cls->max_len++;
+
+	cls->table = malloc(4 * 2 * (cls->max_len + 1));
+	if (cls->table == NULL)
+		return -1;
+
+	for (state = 0; state < 4; state++) {
+		for (level = 0; level < 2; level++) {
+			uint8_t *row = &cls->table[(state * 2 + level) *
+							(cls->max_len + 1)];
+			for (len = 0; len <= cls->max_len; len++) {
+				enum somfy_state new_state =
+					classify(r, state, level, len);
+				uint8_t entry = new_state;
+
+				if ((state == SOMFY_DATA0 || state == SOMFY_DATA1) &&
+				    new_state != SOMFY_DATA0 &&
+				    new_state != SOMFY_DATA1)
+					entry |= ENTRY_END;
+				if (state == SOMFY_PREAMBLE &&
+				    new_state == SOMFY_DATA0)
+					entry |= ENTRY_START;
+				if ((state == SOMFY_DATA0 || state == SOMFY_DATA1) &&
+				    new_state == SOMFY_DATA0)
+					entry |= ENTRY_BIT;
+				if (state == SOMFY_IDLE &&
+				    new_state == SOMFY_PREAMBLE)
+					entry |= ENTRY_PREAMBLE;
+				row[len] = entry;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void somfy_classifier_free(struct somfy_classifier *cls)
+{
+	free(cls->table);
+	cls->table = NULL;
+}
+
+void somfy_decoder_init(struct somfy_decoder *dec,
+			const struct somfy_classifier *cls,
+			somfy_frame_cb_t frame_cb, void *cb_arg)
+{
+	dec->state = SOMFY_IDLE;
+	dec->data_len = 0;
+	dec->data = 0;
+	dec->idle_ended = 0;
+	dec->sample = 0;
+	dec->frame_start = 0;
+	dec->cls = cls;
+	dec->verbose = 0;
+	dec->frame_cb = frame_cb;
+	dec->cb_arg = cb_arg;
+}
+
+/* Report received data, if any, and forget it */
+static void end_frame(struct somfy_decoder *dec)
+{
+	if (dec->data_len) {
+		if (dec->verbose > 0) printf(", len=%u, dat=%jx\n", dec->data_len, (uintmax_t) dec->data);
+
+		if (dec->data_len == 56) {
+			int j;
+			uint64_t m=0xff000000000000;
+			uint64_t data = dec->data;
+
+			// Decrypt by for N=1..len: m[N] = c[N] ^ c[N-1]
+			for (j=0; j<6; j++) {
+				data = (data ^ ((dec->data & m) >> 8));
+				m = m >> 8;
+			}
+
+			if (dec->frame_cb) {
+				dec->frame_cb(dec->cb_arg, data,
+					dec->frame_start, dec->sample);
+			}
+		}
+		dec->data_len = 0;
+	} else {
+		if (dec->verbose > 0) putchar('\n');
+	}
+}
+
+void somfy_decoder_level_change(struct somfy_decoder *dec, int new_level,
+				uint64_t len)
+{
+	const struct somfy_classifier *cls = dec->cls;
+	uint64_t idx = len > cls->max_len ? cls->max_len : len;
+	uint8_t entry;
+
+	entry = cls->table[(dec->state * 2 + new_level) * (cls->max_len + 1) +
+				idx];
+
+	if (entry & ENTRY_END) {
+		// Don't end the frame twice
+		if (! dec->idle_ended)
+			end_frame(dec);
+		dec->idle_ended = 0;
+	}
+	if (entry & ENTRY_PREAMBLE) {
+		dec->frame_start = dec->sample;
+	}
+	if (entry & ENTRY_START) {
+		dec->data_len = 0;
+		dec->data = 0;
+		dec->idle_ended = 0;
+		if (dec->verbose > 0) printf("start: ");
+	}
+	if (entry & ENTRY_BIT) {
+		dec->data = (dec->data << 1) | new_level;
+		dec->data_len++;
+		if (dec->verbose > 0) {
+			printf("%d", new_level); // rising edge == 1, faling edge == 0
+			if ((dec->data_len % 8) == 0) {
+				printf(" ");
+			}
+		}
+	}
+
+	dec->state = entry & ENTRY_STATE_MASK;
+	dec->sample += len;
+}
+
+void somfy_decoder_idle(struct somfy_decoder *dec, int level, uint64_t len)
+{
+	const struct somfy_classifier *cls = dec->cls;
+	uint8_t entry;
+
+	// Shorter pulses can still turn out to be data
+	if (dec->data_len == 0 || len < cls->max_len)
+		return;
+
+	entry = cls->table[(dec->state * 2 + !level) * (cls->max_len + 1) +
+				cls->max_len];
+	if (entry & ENTRY_END) {
+		end_frame(dec);
+		dec->idle_ended = 1;
+	}
+}
@@ -0,0 +1,209 @@
+/**
+ * somfy.h - Somfy RTS frame decoding
+ *
+ * Somfy RTS frame helpers and the pulse length state machine that turns the
+ * level changes of a demodulated OOK signal into frames. Every decoder context
+ * is independent, so multiple streams can be decoded in one process.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SOMFY_H__
+#define __SOMFY_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Nominal sample rate of a demodulated signal, 36 us per sample
+#define SOMFY_SAMPLE_RATE 27778
+// Nominal symbol time in microseconds
+#define SOMFY_SYMBOL_TIME 1280
+
+typedef uint64_t somfy_frame_t;
+
+uint8_t somfy_frame_get_encryption_key(somfy_frame_t frame);
+uint8_t somfy_frame_get_control(somfy_frame_t frame);
+uint8_t somfy_frame_get_chksum(somfy_frame_t frame);
+uint16_t somfy_frame_get_rolling_code(somfy_frame_t frame);
+uint32_t somfy_frame_get_addr(somfy_frame_t frame);
+uint8_t somfy_calc_checksum(somfy_frame_t frame);
+const char *somfy_frame_get_control_name(somfy_frame_t frame);
+
+/**
+ * Build frame with a valid checksum
+ *
+ * The frame is in the same form as the decoder reports it, not obfuscated.
+ */
+somfy_frame_t somfy_frame_new(uint8_t key, uint8_t control,
+				uint16_t rolling_code, uint32_t addr);
+
+/**
+ * Obfuscate frame for transmission
+ *
+ * Every byte is XOR-ed with the previous transmitted byte, the inverse of
+ * what the decoder does.
+ */
+somfy_frame_t somfy_frame_obfuscate(somfy_frame_t frame);
+
+/**
+ * Frame together with what is known about earlier frames of the same remote
+ */
+struct somfy_event {
+	somfy_frame_t frame;
+	// Number of identical copies received after the first
+	unsigned int repeats;
+	// Non-zero if the rolling code isn't higher than of the previous event
+	int regress;
+	uint16_t last_rolling_code;
+	// Time of the first copy in microseconds since the Unix epoch, or 0 if
+	// unknown. This is the time the preamble started if the start time of
+	// the input is known, else the time the frame was decoded.
+	uint64_t time;
+	// Sample indexes of the first copy, see somfy_frame_cb_t
+	uint64_t start_sample;
+	uint64_t end_sample;
+};
+
+/**
+ * Print frame in multi line format
+ *
+ * @param numeric	Don't resolve control and address names if non-zero
+ */
+void somfy_print_frame_long(FILE *fp, somfy_frame_t frame, int numeric);
+
+/**
+ * Print frame in single line format
+ *
+ * @param numeric	Don't resolve control and address names if non-zero
+ */
+void somfy_print_frame_oneline(FILE *fp, somfy_frame_t frame, int numeric);
+
+/**
+ * Print event in multi line format
+ *
+ * Like somfy_print_frame_long(), plus the repeat count and a rolling code
+ * warning if applicable.
+ */
+void somfy_print_event_long(FILE *fp, const struct somfy_event *ev,
+				int numeric);
+
+/**
+ * Print event in single line format
+ */
+void somfy_print_event_oneline(FILE *fp, const struct somfy_event *ev,
+				int numeric);
+
+/************** decoder ********************/
+enum somfy_state { SOMFY_IDLE, SOMFY_PREAMBLE, SOMFY_DATA0, SOMFY_DATA1 };
+
+/**
+ * Called for every received frame of the correct length
+ *
+ * The frame is already de-obfuscated, but the checksum is not verified.
+ *
+ * @param start		Sample index of the start of the preamble
+ * @param end		Sample index of the last level change of the data
+ */
+typedef void (*somfy_frame_cb_t)(void *arg, somfy_frame_t frame,
+					uint64_t start, uint64_t end);
+
+/**
+ * Pulse classifier
+ *
+ * Lookup table giving the next decoder state, and what to do with the data,
+ * for every state, new level and pulse length. Can be shared by any number of
+ * decoders.
+ */
+struct somfy_classifier {
+	uint32_t max_len;
+	uint8_t *table;
+};
+
+struct somfy_decoder {
+	enum somfy_state state;
+	int data_len;
+	uint64_t data;
+	// Frame already ended by somfy_decoder_idle()
+	int idle_ended;
+
+	// Sample index of the last level change, counted from the first
+	// sample passed to the decoder
+	uint64_t sample;
+	uint64_t frame_start;
+
+	const struct somfy_classifier *cls;
+
+	int verbose;
+	somfy_frame_cb_t frame_cb;
+	void *cb_arg;
+};
+
+/**
+ * Build pulse classifier
+ *
+ * The accepted pulse lengths are derived from the sample rate and symbol time.
+ *
+ * @param sample_rate	Sample rate of the demodulated signal in Hz
+ * @param symbol_time	Symbol time in microseconds, normally SOMFY_SYMBOL_TIME
+ *
+ * @returns	0 on success, -1 on error with errno set
+ */
+int somfy_classifier_init(struct somfy_classifier *cls, uint32_t sample_rate,
+				uint32_t symbol_time);
+
+void somfy_classifier_free(struct somfy_classifier *cls);
+
+/**
+ * Initialize decoder
+ *
+ * cls must stay valid while the decoder is used.
+ */
+void somfy_decoder_init(struct somfy_decoder *dec,
+			const struct somfy_classifier *cls,
+			somfy_frame_cb_t frame_cb, void *cb_arg);
+
+/**
+ * Feed level change to decoder
+ *
+ * @param new_level	Level after the change, 0 or 1
+ * @param len		Length in samples of the previous level
+ */
+void somfy_decoder_level_change(struct somfy_decoder *dec, int new_level,
+				uint64_t len);
+
+/**
+ * Tell decoder the current level has not changed for some time
+ *
+ * Normally a frame is only reported at the level change after the gap that
+ * follows it. If the current level already lasts too long to be part of the
+ * frame, this reports the frame right away. The level change must still be
+ * fed to the decoder when it happens.
+ *
+ * @param level		Current level, 0 or 1
+ * @param len		Number of samples since the last level change
+ */
+void somfy_decoder_idle(struct somfy_decoder *dec, int level, uint64_t len);
+
+#endif // __SOMFY_H__
@@ -0,0 +1,209 @@
+/**
+ * somfy_detect.c - Detect Somfy RTS transmissions in AM levels
+ *
+ * The sync pattern only consists of constant pulses, so its correlation with
+ * the input is the sum of the samples under the high pulses minus the sum
+ * under the low pulses. Keeping a running sum of the input gives every pulse
+ * sum as the difference of two running sums, so the correlation costs the
+ * same handful of additions per sample whatever the sample rate. This is
+ * cheaper than an FFT or a vectorized direct correlation, which both grow
+ * with the pattern length.
+ *
+ * The same running sums give the moving average that is passed on inside
+ * detected transmissions.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "somfy_detect.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+// Hardware sync pulse length in symbols, and number of pulses in the pattern
+#define HW_SYNC_SYMBOLS 2
+#define PATTERN_PULSES 4
+// Longest Somfy RTS copy: 7 hardware sync periods, software sync and 56 data
+// symbols, plus some room. In symbols.
+#define WINDOW_SYMBOLS (7 * 2 * HW_SYNC_SYMBOLS + 4 + 56 + 8)
+
+int somfy_detect_init(struct somfy_detect *d, uint32_t sample_rate,
+			uint32_t symbol_time, uint16_t min_level)
+{
+	uint64_t symbol = (uint64_t) sample_rate * symbol_time;
+	size_t size;
+
+	d->seg = HW_SYNC_SYMBOLS * symbol / 1000000;
+	if (d->seg < 2) {
+		errno = EINVAL;
+		return -1;
+	}
+	d->span = PATTERN_PULSES * d->seg;
+	d->window = WINDOW_SYMBOLS * symbol / 1000000;
+	// Average over about half the shortest pulse, a power of 2 so it is
+	// a shift
+	d->avg_shift = 0;
+	while ((2u << d->avg_shift) <= symbol / 4000000) {
+		d->avg_shift++;
+	}
+	// Room to start before the pattern, and to find the best match after
+	// the correlation first exceeds the minimum
+	d->delay = d->span + 2 * d->seg;
+	// Correlation is the level difference times the samples of 2 pulses
+	d->min_corr = (int64_t) min_level * 2 * d->seg;
+
+	size = 1;
+	while (size <= d->delay + (1u << d->avg_shift))
+		size <<= 1;
+	d->mask = size - 1;
+
+	d->sums = calloc(size, sizeof(uint64_t));
+	if (d->sums == NULL) {
+		return -1;
+	}
+
+	d->sum = 0;
+	d->sample = 0;
+	d->cur.start = d->cur.end = 0;
+	d->prev = d->cur;
+
+	return 0;
+}
+
+void somfy_detect_free(struct somfy_detect *d)
+{
+	free(d->sums);
+}
+
+/*
+ * Get output sample
+ *
+ * The average is centered on the sample, so level changes stay in place. The
+ * running sums up to sample + len / 2 must be known.
+ */
+static inline uint16_t output(const struct somfy_detect *d, uint64_t sample)
+{
+	const struct somfy_detect_window *w;
+	uint64_t half = (1u << d->avg_shift) >> 1;
+	int32_t v;
+
+	if (sample >= d->cur.start && sample < d->cur.end)
+		w = &d->cur;
+	else if (sample >= d->prev.start && sample < d->prev.end)
+		w = &d->prev;
+	else
+		return 0;
+	if (sample < half)
+		return 0;
+
+	sample -= half;
+	v = (d->sums[(sample + (1u << d->avg_shift)) & d->mask] -
+			d->sums[sample & d->mask]) >> d->avg_shift;
+	v += w->shift;
+	if (v < 0)
+		return 0;
+	if (v > UINT16_MAX)
+		return UINT16_MAX;
+	return v;
+}
+
+/*
+ * Pattern matched, with the pattern ending at the current sample
+ */
+static void detected(struct somfy_detect *d, int64_t corr, uint64_t total)
+{
+	uint64_t start = d->sample + 1 - d->span;
+	int32_t threshold = total / d->span;
+
+	if (start >= d->cur.end) {
+		// New transmission
+		d->prev = d->cur;
+		d->cur.start = start > d->seg / 2 ? start - d->seg / 2 : 0;
+		d->cur.end = start + d->window;
+		d->cur.corr = 0;
+	} else if (start + d->window > d->cur.end) {
+		d->cur.end = start + d->window;
+	}
+
+	// Follow the best match until the output reaches the window
+	if (corr > d->cur.corr && d->sample < d->cur.start + d->delay) {
+		d->cur.corr = corr;
+		d->cur.shift = SOMFY_DETECT_THRESHOLD - threshold;
+	}
+}
+
+size_t somfy_detect_push(struct somfy_detect *d, const uint16_t *vals,
+				size_t n, uint16_t *out)
+{
+	const size_t mask = d->mask;
+	const uint32_t seg = d->seg;
+	const uint32_t span = d->span;
+	uint64_t *sums = d->sums;
+	size_t nout = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint64_t s = d->sample;
+		uint64_t sum = d->sum;
+
+		// sums[k] is the sum of all samples before sample k
+		sums[s & mask] = sum;
+		sum += vals[i];
+		d->sum = sum;
+
+		if (s + 1 >= span) {
+			uint64_t c1 = sums[(s + 1 - 3 * seg) & mask];
+			uint64_t c2 = sums[(s + 1 - 2 * seg) & mask];
+			uint64_t c3 = sums[(s + 1 - seg) & mask];
+			uint64_t c0 = sums[(s + 1 - span) & mask];
+			// High, low, high, low
+			int64_t corr = (int64_t) (c1 - c0) - (int64_t) (c2 - c1) +
+					(int64_t) (c3 - c2) - (int64_t) (sum - c3);
+
+			if (corr >= d->min_corr)
+				detected(d, corr, sum - c0);
+		}
+
+		if (s >= d->delay)
+			out[nout++] = output(d, s - d->delay);
+		d->sample = s + 1;
+	}
+
+	return nout;
+}
+
+size_t somfy_detect_flush(struct somfy_detect *d, uint16_t *out)
+{
+	uint64_t o = d->sample > d->delay ? d->sample - d->delay : 0;
+	uint64_t half = (1u << d->avg_shift) >> 1;
+	size_t nout = 0;
+
+	d->sums[d->sample & d->mask] = d->sum;
+	// The average of the last samples would need samples after the end
+	for (; o < d->sample; o++)
+		out[nout++] = o + half < d->sample ? output(d, o) : 0;
+
+	return nout;
+}
@@ -0,0 +1,123 @@
+/**
+ * somfy_detect.h - Detect Somfy RTS transmissions in AM levels
+ *
+ * Finds the hardware sync pulses that start every Somfy RTS frame by
+ * correlating the AM levels with two periods of the sync pattern. Because the
+ * correlation averages over thousands of samples, the preamble is found at
+ * signal levels where single samples are mostly noise.
+ *
+ * Only the detected transmissions are passed on, everything in between is
+ * replaced by 0. Inside a transmission the moving average over about half the
+ * shortest pulse is passed on instead of the raw levels, which removes most
+ * of the noise without changing pulse lengths. The levels of a transmission are shifted so the middle between
+ * its carrier and noise floor, as estimated by the correlation, ends up at
+ * SOMFY_DETECT_THRESHOLD. Slicing the output with that threshold gives the best
+ * threshold for every transmission, without tuning.
+ *
+ * To pass on the preamble, which is only recognized after it is received, the
+ * output is delayed. The sample indexes don't change, the first samples are
+ * returned later.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SOMFY_DETECT_H__
+#define __SOMFY_DETECT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Level the threshold of detected transmissions is moved to
+#define SOMFY_DETECT_THRESHOLD 0x8000
+
+struct somfy_detect_window {
+	uint64_t start;
+	uint64_t end;
+	// Level added to the samples, minus SOMFY_DETECT_THRESHOLD
+	int32_t shift;
+	// Correlation the shift is derived from
+	int64_t corr;
+};
+
+struct somfy_detect {
+	// Samples per sync pulse, the pattern is 4 pulses
+	uint32_t seg;
+	uint32_t span;
+	// Samples passed on from the start of the pattern
+	uint32_t window;
+	// Delay of the output
+	uint32_t delay;
+	// Correlation above which the pattern is detected
+	int64_t min_corr;
+	// Log2 of the length of the moving average
+	unsigned int avg_shift;
+
+	// Running sums of the input, sums[k & mask] is the sum of all samples
+	// before sample k. Covers the pattern and the delay.
+	uint64_t *sums;
+	size_t mask;
+	uint64_t sum;
+	uint64_t sample;
+
+	// Current and previous detected transmission
+	struct somfy_detect_window cur;
+	struct somfy_detect_window prev;
+};
+
+/**
+ * Initialize detector
+ *
+ * @param sample_rate	Sample rate of the AM levels in Hz
+ * @param symbol_time	Symbol time in microseconds, normally SOMFY_SYMBOL_TIME
+ * @param min_level	Minimal difference between carrier and noise floor
+ *
+ * @returns	0 on success, -1 on error with errno set
+ */
+int somfy_detect_init(struct somfy_detect *d, uint32_t sample_rate,
+			uint32_t symbol_time, uint16_t min_level);
+
+void somfy_detect_free(struct somfy_detect *d);
+
+/**
+ * Process block of AM levels
+ *
+ * out must have room for n samples.
+ *
+ * @returns	Number of samples written to out, less than n while the delay
+ *		line fills
+ */
+size_t somfy_detect_push(struct somfy_detect *d, const uint16_t *vals,
+				size_t n, uint16_t *out);
+
+/**
+ * Get the samples still in the delay line at the end of the input
+ *
+ * out must have room for d->delay samples.
+ *
+ * @returns	Number of samples written to out
+ */
+size_t somfy_detect_flush(struct somfy_detect *d, uint16_t *out);
+
+#endif // __SOMFY_DETECT_H__
@@ -0,0 +1,156 @@
+/**
+ * somfy_gen.c - Synthesize Somfy RTS signals
+ *
+ * The pulses are placed on a time line in microseconds and only rounded to
+ * samples at their end, so rounding errors don't add up over a frame.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "somfy_gen.h"
+
+#include <string.h>
+
+/*
+ * Pulse lengths in microseconds at the nominal symbol time. The sync pulses
+ * are in the middle of the ranges the decoder accepts.
+ */
+#define HW_SYNC 2448
+#define SW_SYNC 4680
+#define HALF_SYMBOL 640
+#define FRAME_GAP 30415
+
+// Upper bound of a copy with 7 hardware sync pulses, without jitter
+#define MAX_COPY_TIME (7 * 2 * HW_SYNC + SW_SYNC + HALF_SYMBOL + \
+			56 * 2 * HALF_SYMBOL + FRAME_GAP)
+
+/* xorshift64* */
+static uint64_t gen_random(struct somfy_gen *g)
+{
+	g->rng ^= g->rng >> 12;
+	g->rng ^= g->rng << 25;
+	g->rng ^= g->rng >> 27;
+	return g->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform random number in [0, 1) */
+static double gen_uniform(struct somfy_gen *g)
+{
+	return (gen_random(g) >> 11) * (1.0 / (1ULL << 53));
+}
+
+void somfy_gen_init(struct somfy_gen *g, uint32_t sample_rate, uint64_t seed)
+{
+	memset(g, 0, sizeof(*g));
+	g->sample_rate = sample_rate;
+	g->symbol_time = SOMFY_SYMBOL_TIME;
+	g->copies = SOMFY_GEN_COPIES;
+	g->gain = SOMFY_GEN_GAIN;
+	// xorshift gets stuck at 0
+	g->rng = seed ? seed : 1;
+}
+
+size_t somfy_gen_max_samples(const struct somfy_gen *g)
+{
+	double t = (double) MAX_COPY_TIME * g->copies * (1 + g->jitter) *
+			g->symbol_time / SOMFY_SYMBOL_TIME;
+
+	return t * g->sample_rate / 1000000 + g->copies + 1;
+}
+
+/* Append pulse of nominal length us, returns the new sample count */
+static size_t put_pulse(struct somfy_gen *g, int level, uint32_t us,
+			uint8_t *levels, size_t pos)
+{
+	double len = (double) us * g->symbol_time / SOMFY_SYMBOL_TIME;
+	size_t end;
+
+	if (g->jitter != 0) {
+		len *= 1 + g->jitter * (2 * gen_uniform(g) - 1);
+	}
+	g->time += len;
+	end = g->time * g->sample_rate / 1000000 + 0.5;
+
+	if (end > pos) {
+		memset(&levels[pos], level, end - pos);
+		return end;
+	}
+	return pos;
+}
+
+size_t somfy_gen_frame(struct somfy_gen *g, somfy_frame_t frame,
+			uint8_t *levels)
+{
+	uint64_t data = somfy_frame_obfuscate(frame);
+	size_t pos = 0;
+	size_t i;
+	unsigned int copy;
+	int nsync;
+	int bit;
+	int k;
+
+	g->time = 0;
+	for (copy = 0; copy < g->copies; copy++) {
+		nsync = copy == 0 ? 2 : 7;
+		for (k = 0; k < nsync; k++) {
+			pos = put_pulse(g, 1, HW_SYNC, levels, pos);
+			pos = put_pulse(g, 0, HW_SYNC, levels, pos);
+		}
+		pos = put_pulse(g, 1, SW_SYNC, levels, pos);
+		pos = put_pulse(g, 0, HALF_SYMBOL, levels, pos);
+
+		// Manchester encoded, a rising edge is a 1
+		for (k = 55; k >= 0; k--) {
+			bit = (data >> k) & 1;
+			pos = put_pulse(g, !bit, HALF_SYMBOL, levels, pos);
+			pos = put_pulse(g, bit, HALF_SYMBOL, levels, pos);
+		}
+		pos = put_pulse(g, 0, FRAME_GAP, levels, pos);
+	}
+
+	if (g->error_rate != 0) {
+		for (i = 0; i < pos; i++) {
+			if (gen_uniform(g) < g->error_rate)
+				levels[i] ^= 1;
+		}
+	}
+
+	return pos;
+}
+
+void somfy_gen_am(struct somfy_gen *g, const uint8_t *levels, size_t n,
+			uint16_t *out)
+{
+	uint32_t v;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		v = levels[i] ? g->gain : 0;
+		if (g->noise != 0) {
+			v += gen_random(g) % (g->noise + 1);
+		}
+		out[i] = v > UINT16_MAX ? UINT16_MAX : v;
+	}
+}
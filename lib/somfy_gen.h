@@ -0,0 +1,107 @@
+/**
+ * somfy_gen.h - Synthesize Somfy RTS signals
+ *
+ * Generates the OOK signal a remote transmits for a frame, so the decoders can
+ * be tested and benchmarked without a radio. The signal is produced as levels,
+ * one byte per sample, and can be turned into AM levels like rtl_fm outputs.
+ * Pulse length jitter, bit errors, gain and noise can be added to see how the
+ * decoders cope with imperfect signals.
+ *
+ * Every transmission consists of a number of copies of the frame. The first
+ * has 2 hardware sync pulses, the repeats have 7, like a real remote. Copies
+ * are followed by the inter-frame gap.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SOMFY_GEN_H__
+#define __SOMFY_GEN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "somfy.h"
+
+// Copies of every frame a remote transmits for a short button press
+#define SOMFY_GEN_COPIES 3
+// Nominal carrier level of generated AM samples
+#define SOMFY_GEN_GAIN 0x6000
+
+struct somfy_gen {
+	// Output samples per second
+	uint32_t sample_rate;
+	// Symbol time in microseconds
+	uint32_t symbol_time;
+	// Copies of every frame
+	unsigned int copies;
+	// Maximum deviation of pulse lengths, as fraction of the length
+	double jitter;
+	// Probability that a generated level is inverted
+	double error_rate;
+	// AM level of the carrier and maximum amplitude of the added noise
+	uint16_t gain;
+	uint16_t noise;
+
+	uint64_t rng;
+	// Position in microseconds within the current transmission
+	double time;
+};
+
+/**
+ * Initialize generator
+ *
+ * All impairments are off. The fields can be changed before generating.
+ *
+ * @param seed	Seed of the random number generator, the same seed gives the
+ *		same signal
+ */
+void somfy_gen_init(struct somfy_gen *g, uint32_t sample_rate, uint64_t seed);
+
+/**
+ * Maximum number of samples of one transmission
+ */
+size_t somfy_gen_max_samples(const struct somfy_gen *g);
+
+/**
+ * Generate transmission of frame
+ *
+ * @param frame		Frame as reported by the decoder, it is obfuscated here
+ * @param levels	Receives one byte, 0 or 1, per sample. Must have room for
+ *			somfy_gen_max_samples() samples.
+ *
+ * @returns	Number of samples generated
+ */
+size_t somfy_gen_frame(struct somfy_gen *g, somfy_frame_t frame,
+			uint8_t *levels);
+
+/**
+ * Convert levels to AM samples
+ *
+ * A 1 becomes the gain, a 0 becomes 0, then noise is added to every sample.
+ */
+void somfy_gen_am(struct somfy_gen *g, const uint8_t *levels, size_t n,
+			uint16_t *out);
+
+#endif // __SOMFY_GEN_H__
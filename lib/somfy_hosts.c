@@ -0,0 +1,424 @@
+/**
+ * somfy_hosts.c - Somfy remote address to name resolving
+ *
+ * The names are kept in an open addressing hash table keyed on the 24-bit
+ * address, using linear probing. All names are stored back to back in a single
+ * arena, the table only holds their offsets.
+ *
+ * The table used by somfy_addr_to_name() can be replaced while other threads
+ * are using it. Readers only increment and decrement a counter, so they never
+ * block. The thread replacing the table waits until all readers that could
+ * still see the old table are done before freeing it.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "somfy_hosts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#ifdef __linux__
+# include <sys/inotify.h>
+# include <unistd.h>
+#endif
+
+#define EMPTY_SLOT UINT32_MAX
+#define MIN_TABLE_BITS 6
+
+struct somfy_hosts_entry {
+	uint32_t addr;
+	uint32_t name;		// offset in arena
+};
+
+struct somfy_hosts {
+	struct somfy_hosts_entry *table;
+	unsigned int table_bits;
+	size_t count;
+
+	char *arena;
+	size_t arena_len;
+	size_t arena_size;
+};
+
+static struct somfy_hosts *somfy_hosts_cache = NULL;
+static unsigned int hosts_epoch = 0;
+static unsigned int hosts_readers[2] = { 0, 0 };
+
+static inline size_t hash_addr(uint32_t addr, unsigned int bits)
+{
+	return (uint32_t) (addr * 0x9E3779B1u) >> (32 - bits);
+}
+
+static struct somfy_hosts_entry *find_slot(struct somfy_hosts_entry *table,
+					unsigned int bits, uint32_t addr)
+{
+	size_t mask = ((size_t) 1 << bits) - 1;
+	size_t i = hash_addr(addr, bits);
+
+	while (table[i].addr != EMPTY_SLOT && table[i].addr != addr) {
+		i = (i + 1) & mask;
+	}
+
+	return &table[i];
+}
+
+static struct somfy_hosts_entry *alloc_table(unsigned int bits)
+{
+	size_t size = (size_t) 1 << bits;
+	struct somfy_hosts_entry *table;
+	size_t i;
+
+	table = malloc(size * sizeof(*table));
+	if (table == NULL)
+		return NULL;
+	for (i = 0; i < size; i++) {
+		table[i].addr = EMPTY_SLOT;
+	}
+
+	return table;
+}
+
+/* Double table size, keeps the load factor below 1/2 */
+static int grow_table(struct somfy_hosts *hosts)
+{
+	unsigned int bits = hosts->table_bits + 1;
+	size_t old_size = (size_t) 1 << hosts->table_bits;
+	struct somfy_hosts_entry *table;
+	size_t i;
+
+	if ((table = alloc_table(bits)) == NULL)
+		return -1;
+	for (i = 0; i < old_size; i++) {
+		if (hosts->table[i].addr != EMPTY_SLOT) {
+			*find_slot(table, bits, hosts->table[i].addr) =
+							hosts->table[i];
+		}
+	}
+
+	free(hosts->table);
+	hosts->table = table;
+	hosts->table_bits = bits;
+
+	return 0;
+}
+
+static int add_name(struct somfy_hosts *hosts, uint32_t addr, const char *name)
+{
+	size_t len = strlen(name) + 1;
+	struct somfy_hosts_entry *slot;
+
+	if (hosts->arena_len + len > hosts->arena_size) {
+		size_t size = hosts->arena_size * 2;
+		char *arena;
+
+		while (hosts->arena_len + len > size)
+			size *= 2;
+		if ((arena = realloc(hosts->arena, size)) == NULL)
+			return -1;
+		hosts->arena = arena;
+		hosts->arena_size = size;
+	}
+
+	if ((hosts->count + 1) * 2 > ((size_t) 1 << hosts->table_bits)) {
+		if (grow_table(hosts) != 0)
+			return -1;
+	}
+
+	slot = find_slot(hosts->table, hosts->table_bits, addr);
+	if (slot->addr == EMPTY_SLOT) {
+		slot->addr = addr;
+		hosts->count++;
+	}
+	// Duplicate addresses leave the old name unused in the arena
+	slot->name = hosts->arena_len;
+	memcpy(&hosts->arena[hosts->arena_len], name, len);
+	hosts->arena_len += len;
+
+	return 0;
+}
+
+void somfy_hosts_free(struct somfy_hosts *hosts)
+{
+	if (hosts == NULL)
+		return;
+	free(hosts->table);
+	free(hosts->arena);
+	free(hosts);
+}
+
+struct somfy_hosts *somfy_hosts_load(const char *cache_file)
+{
+	FILE *ifp;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t bytes_read;
+	struct somfy_hosts *hosts;
+
+	if ((ifp = fopen(cache_file, "r")) == NULL) {
+		return NULL;
+	}
+
+	if ((hosts = calloc(1, sizeof(*hosts))) == NULL) {
+		fclose(ifp);
+		return NULL;
+	}
+	hosts->table_bits = MIN_TABLE_BITS;
+	hosts->table = alloc_table(hosts->table_bits);
+	hosts->arena_size = 4096;
+	hosts->arena = malloc(hosts->arena_size);
+	if (hosts->table == NULL || hosts->arena == NULL) {
+		goto fail;
+	}
+
+	while ((bytes_read = getline(&line, &len, ifp)) != -1) {
+		char *sp;
+		uint32_t addr;
+
+		// trim '\n', '\r' and other space from the end of the line
+		while (bytes_read > 0 && isspace(line[bytes_read - 1])) {
+			line[bytes_read - 1] = '\0';
+			bytes_read--;
+		}
+
+		if (bytes_read < 8)
+			continue;
+
+		// addr
+		addr = strtol(line, &sp, 16);
+		if (sp != &(line[6]) || !isspace(*sp) || addr > 0xFFFFFF) {
+			continue;
+		}
+
+		// delim
+		while (isspace(*sp)) {
+			sp++;
+		}
+		if (strlen(sp) == 0) {
+			continue;
+		}
+
+		// name
+		if (add_name(hosts, addr, sp) != 0) {
+			goto fail;
+		}
+	}
+
+	free(line);
+	fclose(ifp);
+
+	return hosts;
+
+fail:
+	free(line);
+	fclose(ifp);
+	somfy_hosts_free(hosts);
+	return NULL;
+}
+
+const char *somfy_hosts_lookup(const struct somfy_hosts *hosts, uint32_t addr)
+{
+	const struct somfy_hosts_entry *slot;
+
+	if (hosts == NULL)
+		return NULL;
+
+	slot = find_slot(hosts->table, hosts->table_bits, addr);
+	if (slot->addr == EMPTY_SLOT)
+		return NULL;
+
+	return &hosts->arena[slot->name];
+}
+
+int somfy_hosts_read_begin(void)
+{
+	int slot = __atomic_load_n(&hosts_epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&hosts_readers[slot], 1, __ATOMIC_SEQ_CST);
+	return slot;
+}
+
+void somfy_hosts_read_end(int slot)
+{
+	__atomic_sub_fetch(&hosts_readers[slot], 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Wait until all readers that started before now are done
+ *
+ * New readers are counted in the other slot after every epoch flip, so each
+ * slot is guaranteed to drain.
+ */
+static void hosts_synchronize(void)
+{
+	const struct timespec delay = { 0, 1000000 };
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		int slot = __atomic_fetch_add(&hosts_epoch, 1, __ATOMIC_SEQ_CST) & 1;
+		while (__atomic_load_n(&hosts_readers[slot], __ATOMIC_SEQ_CST) != 0) {
+			nanosleep(&delay, NULL);
+		}
+	}
+}
+
+static void hosts_replace(struct somfy_hosts *hosts)
+{
+	struct somfy_hosts *old;
+
+	old = __atomic_exchange_n(&somfy_hosts_cache, hosts, __ATOMIC_SEQ_CST);
+	if (old != NULL) {
+		hosts_synchronize();
+		somfy_hosts_free(old);
+	}
+}
+
+void somfy_hosts_cache_init(const char *cache_file)
+{
+	struct somfy_hosts *hosts;
+
+	if ((hosts = somfy_hosts_load(cache_file)) == NULL) {
+		return;
+	}
+
+	hosts_replace(hosts);
+}
+
+const char *somfy_addr_to_name(uint32_t addr)
+{
+	return somfy_hosts_lookup(
+		__atomic_load_n(&somfy_hosts_cache, __ATOMIC_SEQ_CST), addr);
+}
+
+#ifdef __linux__
+struct watch_ctx {
+	int fd;
+	char *path;
+	char *name;
+};
+
+static void *watch_thread(void *arg)
+{
+	struct watch_ctx *ctx = (struct watch_ctx *) arg;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(ctx->fd, buf, sizeof(buf))) != 0) {
+		const struct inotify_event *ev;
+		char *p;
+		int changed = 0;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Failed reading inotify events");
+			break;
+		}
+
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *) p;
+			if (ev->len > 0 && strcmp(ev->name, ctx->name) == 0) {
+				changed = 1;
+			}
+		}
+
+		if (changed) {
+			// Keep the old names if the file is (temporarily) gone
+			struct somfy_hosts *hosts = somfy_hosts_load(ctx->path);
+			if (hosts != NULL) {
+				hosts_replace(hosts);
+			}
+		}
+	}
+
+	close(ctx->fd);
+	free(ctx->path);
+	free(ctx->name);
+	free(ctx);
+	return NULL;
+}
+
+int somfy_hosts_cache_watch(const char *cache_file)
+{
+	struct watch_ctx *ctx;
+	char *dir_buf = NULL;
+	char *name_buf = NULL;
+	pthread_t thread;
+	int err;
+
+	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+		return -1;
+	ctx->fd = -1;
+
+	// dirname() and basename() may modify their argument
+	ctx->path = strdup(cache_file);
+	dir_buf = strdup(cache_file);
+	name_buf = strdup(cache_file);
+	if (ctx->path == NULL || dir_buf == NULL || name_buf == NULL)
+		goto fail;
+	if ((ctx->name = strdup(basename(name_buf))) == NULL)
+		goto fail;
+
+	// Watch the directory, editors often replace the file by renaming
+	if ((ctx->fd = inotify_init1(IN_CLOEXEC)) == -1)
+		goto fail;
+	if (inotify_add_watch(ctx->fd, dirname(dir_buf),
+				IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+		goto fail;
+
+	if ((err = pthread_create(&thread, NULL, watch_thread, ctx)) != 0) {
+		errno = err;
+		goto fail;
+	}
+	pthread_detach(thread);
+
+	free(dir_buf);
+	free(name_buf);
+	return 0;
+
+fail:
+	err = errno;
+	if (ctx->fd != -1)
+		close(ctx->fd);
+	free(ctx->path);
+	free(ctx->name);
+	free(ctx);
+	free(dir_buf);
+	free(name_buf);
+	errno = err;
+	return -1;
+}
+#else
+int somfy_hosts_cache_watch(const char *cache_file)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
@@ -0,0 +1,99 @@
+/**
+ * somfy_hosts.h - Somfy remote address to name resolving
+ *
+ * Resolves remote addresses to human readable names. The names are read from a
+ * file containing a hexadecimal remote address followed by the name on every
+ * line.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SOMFY_HOSTS_H__
+#define __SOMFY_HOSTS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Address to name lookup table */
+struct somfy_hosts;
+
+/**
+ * Load remote names from file
+ *
+ * If an address occurs multiple times the last name is used.
+ *
+ * @returns	New table, or NULL if the file can't be opened
+ */
+struct somfy_hosts *somfy_hosts_load(const char *cache_file);
+
+void somfy_hosts_free(struct somfy_hosts *hosts);
+
+/**
+ * Lookup name of remote
+ *
+ * @returns	Name, owned by the table, or NULL if the address is unknown
+ */
+const char *somfy_hosts_lookup(const struct somfy_hosts *hosts, uint32_t addr);
+
+/**
+ * Load remote names used by somfy_addr_to_name()
+ *
+ * Silently does nothing if the file can't be opened.
+ */
+void somfy_hosts_cache_init(const char *cache_file);
+
+/**
+ * Reload remote names whenever the file changes
+ *
+ * Starts a background thread that loads the file in a new table when it is
+ * written or replaced, and then swaps it in place of the current table.
+ *
+ * @returns	0 on success, -1 on error with errno set
+ */
+int somfy_hosts_cache_watch(const char *cache_file);
+
+/**
+ * Start using the table loaded by somfy_hosts_cache_init()
+ *
+ * Names returned by somfy_addr_to_name() stay valid until the matching
+ * somfy_hosts_read_end() call. Never blocks.
+ *
+ * @returns	Value to pass to somfy_hosts_read_end()
+ */
+int somfy_hosts_read_begin(void);
+
+void somfy_hosts_read_end(int slot);
+
+/**
+ * Lookup name of remote in the table loaded by somfy_hosts_cache_init()
+ *
+ * Must be called between somfy_hosts_read_begin() and somfy_hosts_read_end()
+ * if the table can be reloaded.
+ *
+ * @returns	Name, or NULL if the address is unknown
+ */
+const char *somfy_addr_to_name(uint32_t addr);
+
+#endif // __SOMFY_HOSTS_H__
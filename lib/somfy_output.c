@@ -0,0 +1,434 @@
+/**
+ * somfy_output.c - Decoded frame output formats
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "somfy_output.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+
+#include "somfy_hosts.h"
+
+uint64_t somfy_monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t somfy_realtime_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int somfy_source_init(struct somfy_source *src, uint32_t rate, uint32_t scale,
+			uint64_t epoch, bool track, bool live,
+			somfy_event_cb_t cb, void *cb_arg)
+{
+	src->epoch = epoch;
+	src->rate = rate;
+	src->scale = scale;
+	src->live = live;
+	src->cb = cb;
+	src->cb_arg = cb_arg;
+	src->track = NULL;
+	if (track && (src->track = somfy_track_new(SOMFY_TRACK_SIZE,
+					SOMFY_TRACK_WINDOW, cb,
+					cb_arg)) == NULL) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Time of decoder sample in microseconds since the first sample */
+static uint64_t signal_us(const struct somfy_source *src, uint64_t sample)
+{
+	sample *= src->scale;
+	return sample / src->rate * 1000000 +
+			sample % src->rate * 1000000 / src->rate;
+}
+
+/*
+ * Time for the repeat window of the tracker
+ *
+ * The signal time is taken at the end of the frame. Frames are reported after
+ * their end, but never before the last level change the decoder has seen, so
+ * it doesn't decrease when somfy_source_expire() uses that level change.
+ */
+static uint64_t track_time(const struct somfy_source *src, uint64_t sample)
+{
+	if (src->live) {
+		return somfy_monotonic_us();
+	}
+	return signal_us(src, sample);
+}
+
+/*
+ * Time of sample in microseconds since the Unix epoch
+ *
+ * Falls back to the current time if the time of the first sample is unknown.
+ */
+static uint64_t sample_time(const struct somfy_source *src, uint64_t sample)
+{
+	if (src->epoch == 0) {
+		return somfy_realtime_us();
+	}
+	return src->epoch + sample / src->rate * 1000000 +
+			sample % src->rate * 1000000 / src->rate;
+}
+
+void somfy_source_frame_cb(void *arg, somfy_frame_t frame, uint64_t start,
+				uint64_t end)
+{
+	struct somfy_source *src = (struct somfy_source *) arg;
+	struct somfy_event ev = {
+		.frame = frame,
+		.start_sample = start * src->scale,
+		.end_sample = end * src->scale,
+	};
+
+	ev.time = sample_time(src, ev.start_sample);
+	if (src->track != NULL) {
+		somfy_track_frame(src->track, &ev, track_time(src, end));
+	} else {
+		src->cb(src->cb_arg, &ev);
+	}
+}
+
+void somfy_source_expire(struct somfy_source *src,
+				const struct somfy_decoder *dec)
+{
+	if (src->track != NULL) {
+		somfy_track_expire(src->track, track_time(src, dec->sample));
+	}
+}
+
+void somfy_source_close(struct somfy_source *src)
+{
+	if (src->track != NULL) {
+		somfy_track_flush(src->track);
+		somfy_track_free(src->track);
+		src->track = NULL;
+	}
+}
+
+void somfy_output_event_cb(void *arg, const struct somfy_event *ev)
+{
+	somfy_output_write((struct somfy_output *) arg, ev, NULL, 0);
+}
+
+static void put_le(uint8_t *buf, uint64_t val, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = val >> (i * 8);
+	}
+}
+
+int somfy_output_parse_format(const char *name,
+				enum somfy_output_format *format)
+{
+	static const struct {
+		const char *name;
+		enum somfy_output_format format;
+	} formats[] = {
+		{ "long", SOMFY_OUTPUT_LONG },
+		{ "oneline", SOMFY_OUTPUT_ONELINE },
+		{ "json", SOMFY_OUTPUT_JSON },
+		{ "binary", SOMFY_OUTPUT_BINARY },
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (strcmp(name, formats[i].name) == 0) {
+			*format = formats[i].format;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int somfy_output_init(struct somfy_output *out, FILE *fp,
+			enum somfy_output_format format, int numeric,
+			unsigned int flush_frames, uint64_t flush_delay)
+{
+	uint8_t hdr[SOMFY_RECORD_HEADER_SIZE];
+
+	out->fp = fp;
+	out->format = format;
+	out->numeric = numeric;
+	out->flush_frames = flush_frames;
+	out->flush_delay = flush_delay;
+	out->pending = 0;
+	out->pending_since = 0;
+	out->err = 0;
+	pthread_mutex_init(&out->lock, NULL);
+
+	// Flushing is done here, not by stdio
+	setvbuf(fp, NULL, _IOFBF, SOMFY_OUTPUT_BUF_SIZE);
+
+	if (format == SOMFY_OUTPUT_BINARY) {
+		memset(hdr, 0, sizeof(hdr));
+		memcpy(&hdr[0], SOMFY_RECORD_MAGIC, 4);
+		hdr[4] = SOMFY_RECORD_VERSION;
+		hdr[5] = SOMFY_RECORD_SIZE;
+		if (fwrite(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) {
+			out->err = errno;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Write string as JSON string */
+static void json_string(FILE *fp, const char *str)
+{
+	const unsigned char *p;
+
+	fputc('"', fp);
+	for (p = (const unsigned char *) str; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\') {
+			fputc('\\', fp);
+			fputc(*p, fp);
+		} else if (*p < 0x20) {
+			fprintf(fp, "\\u%.4x", *p);
+		} else {
+			fputc(*p, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+static void format_json(const struct somfy_output *out, FILE *fp,
+			const struct somfy_event *ev, const char *channel)
+{
+	somfy_frame_t frame = ev->frame;
+	uint32_t addr;
+	const char *name;
+
+	fputc('{', fp);
+	if (ev->time != 0) {
+		fprintf(fp, "\"time\":%" PRIu64 ".%.6u,", ev->time / 1000000,
+				(unsigned int) (ev->time % 1000000));
+	}
+	fprintf(fp, "\"start_sample\":%" PRIu64 ",\"end_sample\":%" PRIu64 ",",
+			ev->start_sample, ev->end_sample);
+	if (channel != NULL) {
+		fputs("\"channel\":", fp);
+		json_string(fp, channel);
+		fputc(',', fp);
+	}
+	fprintf(fp, "\"frame\":\"%.14jx\",", (uintmax_t) frame);
+
+	if (somfy_calc_checksum(frame) != 0) {
+		fputs("\"checksum_ok\":false}\n", fp);
+		return;
+	}
+
+	addr = somfy_frame_get_addr(frame);
+	fprintf(fp, "\"checksum_ok\":true,\"key\":%u,\"control\":%u,",
+			somfy_frame_get_encryption_key(frame),
+			somfy_frame_get_control(frame));
+	if (! out->numeric) {
+		fprintf(fp, "\"control_name\":\"%s\",",
+				somfy_frame_get_control_name(frame));
+	}
+	fprintf(fp, "\"rolling_code\":%u,\"address\":\"%.6x\"",
+			somfy_frame_get_rolling_code(frame), addr);
+	if (! out->numeric) {
+		int slot = somfy_hosts_read_begin();
+		if ((name = somfy_addr_to_name(addr)) != NULL) {
+			fputs(",\"name\":", fp);
+			json_string(fp, name);
+		}
+		somfy_hosts_read_end(slot);
+	}
+	fprintf(fp, ",\"repeats\":%u,\"regress\":%s", ev->repeats,
+			ev->regress ? "true" : "false");
+	if (ev->regress) {
+		fprintf(fp, ",\"last_rolling_code\":%u", ev->last_rolling_code);
+	}
+	fputs("}\n", fp);
+}
+
+static void format_binary(FILE *fp, const struct somfy_event *ev,
+				uint32_t index)
+{
+	uint8_t rec[SOMFY_RECORD_SIZE];
+	uint8_t flags = 0;
+
+	if (somfy_calc_checksum(ev->frame) == 0)
+		flags |= SOMFY_RECORD_FLAG_CHECKSUM_OK;
+	if (ev->regress)
+		flags |= SOMFY_RECORD_FLAG_REGRESS;
+
+	memset(rec, 0, sizeof(rec));
+	put_le(&rec[0], ev->frame, 8);
+	put_le(&rec[8], ev->time, 8);
+	put_le(&rec[16], ev->repeats, 4);
+	put_le(&rec[20], index, 4);
+	put_le(&rec[24], ev->last_rolling_code, 2);
+	rec[26] = flags;
+	put_le(&rec[32], ev->start_sample, 8);
+	put_le(&rec[40], ev->end_sample, 8);
+
+	fwrite(rec, 1, sizeof(rec), fp);
+}
+
+void somfy_output_format(const struct somfy_output *out, FILE *fp,
+			const struct somfy_event *ev, const char *channel,
+			uint32_t index)
+{
+	switch (out->format) {
+	case SOMFY_OUTPUT_LONG:
+		if (channel != NULL) {
+			fprintf(fp, "Channel = %s\n", channel);
+		}
+		somfy_print_event_long(fp, ev, out->numeric);
+		break;
+	case SOMFY_OUTPUT_ONELINE:
+		if (channel != NULL) {
+			fprintf(fp, "%s: ", channel);
+		}
+		somfy_print_event_oneline(fp, ev, out->numeric);
+		break;
+	case SOMFY_OUTPUT_JSON:
+		format_json(out, fp, ev, channel);
+		break;
+	case SOMFY_OUTPUT_BINARY:
+		format_binary(fp, ev, index);
+		break;
+	}
+}
+
+/* Flush with lock held */
+static int flush_locked(struct somfy_output *out)
+{
+	if (fflush(out->fp) != 0 && out->err == 0) {
+		out->err = errno;
+	}
+	out->pending = 0;
+
+	if (out->err != 0) {
+		errno = out->err;
+		return -1;
+	}
+	return 0;
+}
+
+/* Apply flush policy after writing a frame, with lock held */
+static int frame_written(struct somfy_output *out)
+{
+	uint64_t now = somfy_monotonic_us();
+
+	if (ferror(out->fp) && out->err == 0) {
+		out->err = errno ? errno : EIO;
+	}
+	if (out->pending++ == 0) {
+		out->pending_since = now;
+	}
+	if ((out->flush_frames != 0 && out->pending >= out->flush_frames) ||
+	    (out->flush_delay != 0 &&
+	     now - out->pending_since >= out->flush_delay)) {
+		return flush_locked(out);
+	}
+
+	if (out->err != 0) {
+		errno = out->err;
+		return -1;
+	}
+	return 0;
+}
+
+int somfy_output_write(struct somfy_output *out, const struct somfy_event *ev,
+			const char *channel, uint32_t index)
+{
+	int ret;
+
+	pthread_mutex_lock(&out->lock);
+	somfy_output_format(out, out->fp, ev, channel, index);
+	ret = frame_written(out);
+	pthread_mutex_unlock(&out->lock);
+
+	return ret;
+}
+
+int somfy_output_write_raw(struct somfy_output *out, const void *buf,
+				size_t len)
+{
+	int ret;
+
+	pthread_mutex_lock(&out->lock);
+	fwrite(buf, 1, len, out->fp);
+	ret = frame_written(out);
+	pthread_mutex_unlock(&out->lock);
+
+	return ret;
+}
+
+int somfy_output_poll(struct somfy_output *out)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&out->lock);
+	if (out->pending > 0 && out->flush_delay != 0 &&
+	    somfy_monotonic_us() - out->pending_since >= out->flush_delay) {
+		ret = flush_locked(out);
+	}
+	pthread_mutex_unlock(&out->lock);
+
+	return ret;
+}
+
+int somfy_output_flush(struct somfy_output *out)
+{
+	int ret;
+
+	pthread_mutex_lock(&out->lock);
+	ret = flush_locked(out);
+	pthread_mutex_unlock(&out->lock);
+
+	return ret;
+}
+
+int somfy_output_close(struct somfy_output *out)
+{
+	int ret = somfy_output_flush(out);
+
+	pthread_mutex_destroy(&out->lock);
+	return ret;
+}
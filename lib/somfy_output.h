@@ -0,0 +1,269 @@
+/**
+ * somfy_output.h - Decoded frame output formats
+ *
+ * Writes decoded frames in one of the human readable layouts, as JSON lines or
+ * as fixed size binary records. Output is buffered and flushed according to an
+ * explicit policy: after a number of frames, and/or when the oldest unflushed
+ * frame has waited for a maximum time.
+ *
+ * A somfy_source connects a decoder to the output: it turns the frames of one
+ * input into events and passes them through a repeat tracker, if enabled.
+ *
+ * JSON lines contain one object per frame with the fields:
+ *
+ *   time		Time in seconds since the Unix epoch, if known. This is
+ *			the start of the frame if the start time of the input is
+ *			known, else the time it was decoded.
+ *   start_sample	Sample index of the start of the preamble
+ *   end_sample		Sample index of the last level change of the data
+ *   channel		Input name, in multi-channel mode
+ *   frame		Frame as hexadecimal string
+ *   checksum_ok	Boolean, the remaining fields are only present if true
+ *   key, control	Encryption key and control code
+ *   control_name	Name of control code, unless numeric output is used
+ *   rolling_code
+ *   address		Remote address as hexadecimal string
+ *   name		Remote name, if known and numeric output isn't used
+ *   repeats		Number of identical copies, if repeats are suppressed
+ *   regress		Boolean, true if the rolling code didn't increase
+ *   last_rolling_code	Rolling code of the previous frame, if regress is true
+ *
+ * Binary output starts with a header of SOMFY_RECORD_HEADER_SIZE bytes, all
+ * multi-byte fields are little endian:
+ *
+ *   offset  size  field
+ *   0       4     magic, "SOMF"
+ *   4       1     version, SOMFY_RECORD_VERSION
+ *   5       1     record size in bytes, SOMFY_RECORD_SIZE
+ *   6       2     reserved, must be 0
+ *
+ * Followed by a record of the given size for every frame:
+ *
+ *   offset  size  field
+ *   0       8     frame
+ *   8       8     time in microseconds since the Unix epoch, 0 if unknown
+ *   16      4     repeats
+ *   20      4     channel index, order of the inputs on the command line
+ *   24      2     last rolling code, valid if the regress flag is set
+ *   26      1     flags, bit 0: checksum OK, bit 1: rolling code regress
+ *   27      5     reserved, must be 0
+ *   32      8     start sample index
+ *   40      8     end sample index
+ *
+ * Readers should use the record size from the header, so fields can be added
+ * at the end.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SOMFY_OUTPUT_H__
+#define __SOMFY_OUTPUT_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "somfy.h"
+#include "somfy_track.h"
+
+#define SOMFY_RECORD_MAGIC "SOMF"
+#define SOMFY_RECORD_VERSION 1
+#define SOMFY_RECORD_HEADER_SIZE 8
+#define SOMFY_RECORD_SIZE 48
+
+#define SOMFY_RECORD_FLAG_CHECKSUM_OK 0x01
+#define SOMFY_RECORD_FLAG_REGRESS 0x02
+
+// Size of output buffer
+#define SOMFY_OUTPUT_BUF_SIZE 65536
+// Default maximum time a frame waits in the buffer, in microseconds
+#define SOMFY_OUTPUT_DELAY 1000000
+
+enum somfy_output_format {
+	SOMFY_OUTPUT_LONG,
+	SOMFY_OUTPUT_ONELINE,
+	SOMFY_OUTPUT_JSON,
+	SOMFY_OUTPUT_BINARY,
+};
+
+struct somfy_output {
+	FILE *fp;
+	enum somfy_output_format format;
+	int numeric;
+
+	// Flush policy, 0 disables the limit
+	unsigned int flush_frames;
+	uint64_t flush_delay;
+
+	pthread_mutex_t lock;
+	unsigned int pending;
+	uint64_t pending_since;
+	int err;
+};
+
+/**
+ * Frames of one decoded input
+ */
+struct somfy_source {
+	// Time of sample 0 in microseconds since the Unix epoch, 0 if unknown
+	uint64_t epoch;
+	// Sample rate of the reported sample indexes
+	uint32_t rate;
+	// Reported sample indexes per decoder sample, for down-sampled input
+	uint32_t scale;
+	// Use the time of arrival for the repeat window instead of the signal
+	// time, for input that is decoded while it is received
+	bool live;
+
+	// NULL if repeats are not suppressed
+	struct somfy_track *track;
+	somfy_event_cb_t cb;
+	void *cb_arg;
+};
+
+/* Monotonic time in microseconds */
+uint64_t somfy_monotonic_us(void);
+
+/* Wall clock time in microseconds since the Unix epoch */
+uint64_t somfy_realtime_us(void);
+
+/**
+ * Initialize source
+ *
+ * @param track		Suppress repeated frames if true
+ * @param live		See struct somfy_source
+ * @param cb		Called for every event, see also somfy_output_event_cb()
+ *
+ * @returns	0 on success, -1 on error with errno set
+ */
+int somfy_source_init(struct somfy_source *src, uint32_t rate, uint32_t scale,
+			uint64_t epoch, bool track, bool live,
+			somfy_event_cb_t cb, void *cb_arg);
+
+/**
+ * Decoder frame callback
+ *
+ * @param arg	Pointer to struct somfy_source
+ */
+void somfy_source_frame_cb(void *arg, somfy_frame_t frame, uint64_t start,
+				uint64_t end);
+
+/**
+ * Report tracked events of which the repeat window ended
+ *
+ * @param dec	Decoder of the source, gives the signal time
+ */
+void somfy_source_expire(struct somfy_source *src,
+				const struct somfy_decoder *dec);
+
+/**
+ * Report all pending events and release resources
+ */
+void somfy_source_close(struct somfy_source *src);
+
+/**
+ * Event callback writing the event to the output
+ *
+ * Write errors are reported by the next somfy_output_poll(),
+ * somfy_output_flush() or somfy_output_close().
+ *
+ * @param arg	Pointer to struct somfy_output
+ */
+void somfy_output_event_cb(void *arg, const struct somfy_event *ev);
+
+/**
+ * Get format by name: long, oneline, json or binary
+ *
+ * @returns	0 on success, -1 if the name is unknown
+ */
+int somfy_output_parse_format(const char *name,
+				enum somfy_output_format *format);
+
+/**
+ * Initialize output and write the header, if any
+ *
+ * Takes over buffering of fp.
+ *
+ * @param numeric	Don't resolve control and address names if non-zero
+ * @param flush_frames	Flush after this many frames, 0 for no limit
+ * @param flush_delay	Flush when a frame has waited this many microseconds,
+ *			0 for no limit. Only checked when frames are written or
+ *			somfy_output_poll() is called.
+ *
+ * @returns	0 on success, -1 on error with errno set
+ */
+int somfy_output_init(struct somfy_output *out, FILE *fp,
+			enum somfy_output_format format, int numeric,
+			unsigned int flush_frames, uint64_t flush_delay);
+
+/**
+ * Format event
+ *
+ * Formats without writing to the output or applying the flush policy, so the
+ * result can be passed to somfy_output_write_raw() later.
+ *
+ * @param channel	Input name, or NULL if there is only one input
+ * @param index		Input number, used for binary records
+ */
+void somfy_output_format(const struct somfy_output *out, FILE *fp,
+			const struct somfy_event *ev, const char *channel,
+			uint32_t index);
+
+/**
+ * Write event
+ *
+ * Thread safe.
+ *
+ * @returns	0 on success, -1 if this or an earlier write failed, with
+ *		errno set
+ */
+int somfy_output_write(struct somfy_output *out, const struct somfy_event *ev,
+			const char *channel, uint32_t index);
+
+/**
+ * Write event formatted by somfy_output_format()
+ *
+ * Thread safe.
+ */
+int somfy_output_write_raw(struct somfy_output *out, const void *buf,
+				size_t len);
+
+/**
+ * Flush output if the oldest frame waited too long
+ */
+int somfy_output_poll(struct somfy_output *out);
+
+/**
+ * Flush output
+ */
+int somfy_output_flush(struct somfy_output *out);
+
+/**
+ * Flush output and release resources
+ */
+int somfy_output_close(struct somfy_output *out);
+
+#endif // __SOMFY_OUTPUT_H__
@@ -0,0 +1,292 @@
+/**
+ * somfy_track.c - Somfy remote tracking and repeat suppression
+ *
+ * The remote states live in a fixed array. They are found through a chained
+ * hash table, and are linked in a least recently seen list for eviction.
+ * Remotes with an event that still waits for copies are also linked in a
+ * pending list, ordered by time of the last copy, so expired events are
+ * always at its head. All links are array indices.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "somfy_track.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#define NIL UINT32_MAX
+
+struct link {
+	uint32_t prev, next;
+};
+
+struct remote {
+	uint32_t addr;
+	uint16_t rolling_code;
+	bool pending;
+
+	struct somfy_event ev;
+	uint64_t last_seen;
+
+	uint32_t hash_next;
+	struct link lru;
+	struct link pend;
+};
+
+struct list {
+	uint32_t head, tail;
+};
+
+struct somfy_track {
+	struct remote *remotes;
+	size_t size;
+	size_t count;
+
+	uint32_t *buckets;
+	unsigned int bucket_bits;
+
+	// Most recently seen first
+	struct list lru;
+	// Oldest last copy first
+	struct list pending;
+
+	uint64_t window;
+	somfy_event_cb_t cb;
+	void *cb_arg;
+};
+
+static inline size_t hash_addr(uint32_t addr, unsigned int bits)
+{
+	return (uint32_t) (addr * 0x9E3779B1u) >> (32 - bits);
+}
+
+/*
+ * Doubly linked lists through the remote array, off selects the link in
+ * struct remote
+ */
+#define LINK(t, i, off) ((struct link *) ((char *) &(t)->remotes[i] + (off)))
+#define LRU offsetof(struct remote, lru)
+#define PEND offsetof(struct remote, pend)
+
+static void list_remove(struct somfy_track *t, struct list *l, size_t off,
+			uint32_t i)
+{
+	struct link *link = LINK(t, i, off);
+
+	if (link->prev != NIL)
+		LINK(t, link->prev, off)->next = link->next;
+	else
+		l->head = link->next;
+	if (link->next != NIL)
+		LINK(t, link->next, off)->prev = link->prev;
+	else
+		l->tail = link->prev;
+}
+
+static void list_push_head(struct somfy_track *t, struct list *l, size_t off,
+				uint32_t i)
+{
+	struct link *link = LINK(t, i, off);
+
+	link->prev = NIL;
+	link->next = l->head;
+	if (l->head != NIL)
+		LINK(t, l->head, off)->prev = i;
+	else
+		l->tail = i;
+	l->head = i;
+}
+
+static void list_push_tail(struct somfy_track *t, struct list *l, size_t off,
+				uint32_t i)
+{
+	struct link *link = LINK(t, i, off);
+
+	link->next = NIL;
+	link->prev = l->tail;
+	if (l->tail != NIL)
+		LINK(t, l->tail, off)->next = i;
+	else
+		l->head = i;
+	l->tail = i;
+}
+
+static uint32_t find_remote(struct somfy_track *t, uint32_t addr)
+{
+	uint32_t i = t->buckets[hash_addr(addr, t->bucket_bits)];
+
+	while (i != NIL && t->remotes[i].addr != addr) {
+		i = t->remotes[i].hash_next;
+	}
+	return i;
+}
+
+static void hash_remove(struct somfy_track *t, uint32_t i)
+{
+	uint32_t *p = &t->buckets[hash_addr(t->remotes[i].addr,
+						t->bucket_bits)];
+
+	while (*p != i) {
+		p = &t->remotes[*p].hash_next;
+	}
+	*p = t->remotes[i].hash_next;
+}
+
+/* Report pending event of remote */
+static void report(struct somfy_track *t, uint32_t i)
+{
+	struct remote *r = &t->remotes[i];
+
+	list_remove(t, &t->pending, PEND, i);
+	r->pending = false;
+	t->cb(t->cb_arg, &r->ev);
+}
+
+struct somfy_track *somfy_track_new(size_t size, uint64_t window,
+					somfy_event_cb_t cb, void *cb_arg)
+{
+	struct somfy_track *t;
+	size_t i;
+
+	if (size == 0 || size >= NIL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((t = calloc(1, sizeof(*t))) == NULL)
+		return NULL;
+
+	// At least two buckets per remote
+	t->bucket_bits = 1;
+	while (((size_t) 1 << t->bucket_bits) < size * 2)
+		t->bucket_bits++;
+
+	t->remotes = malloc(size * sizeof(*t->remotes));
+	t->buckets = malloc(((size_t) 1 << t->bucket_bits) * sizeof(uint32_t));
+	if (t->remotes == NULL || t->buckets == NULL) {
+		somfy_track_free(t);
+		return NULL;
+	}
+	for (i = 0; i < ((size_t) 1 << t->bucket_bits); i++) {
+		t->buckets[i] = NIL;
+	}
+
+	t->size = size;
+	t->lru.head = t->lru.tail = NIL;
+	t->pending.head = t->pending.tail = NIL;
+	t->window = window;
+	t->cb = cb;
+	t->cb_arg = cb_arg;
+
+	return t;
+}
+
+void somfy_track_free(struct somfy_track *t)
+{
+	if (t == NULL)
+		return;
+	free(t->remotes);
+	free(t->buckets);
+	free(t);
+}
+
+void somfy_track_expire(struct somfy_track *t, uint64_t now)
+{
+	while (t->pending.head != NIL &&
+	       t->remotes[t->pending.head].last_seen + t->window <= now) {
+		report(t, t->pending.head);
+	}
+}
+
+void somfy_track_flush(struct somfy_track *t)
+{
+	while (t->pending.head != NIL) {
+		report(t, t->pending.head);
+	}
+}
+
+void somfy_track_frame(struct somfy_track *t, const struct somfy_event *ev,
+			uint64_t now)
+{
+	somfy_frame_t frame = ev->frame;
+	uint32_t addr = somfy_frame_get_addr(frame);
+	uint16_t rolling_code = somfy_frame_get_rolling_code(frame);
+	struct remote *r;
+	bool known = true;
+	uint32_t i;
+
+	somfy_track_expire(t, now);
+
+	if (somfy_calc_checksum(frame) != 0) {
+		t->cb(t->cb_arg, ev);
+		return;
+	}
+
+	if ((i = find_remote(t, addr)) != NIL) {
+		r = &t->remotes[i];
+		if (r->pending && r->ev.frame == frame) {
+			r->ev.repeats++;
+			r->last_seen = now;
+			list_remove(t, &t->pending, PEND, i);
+			list_push_tail(t, &t->pending, PEND, i);
+			list_remove(t, &t->lru, LRU, i);
+			list_push_head(t, &t->lru, LRU, i);
+			return;
+		}
+		if (r->pending) {
+			report(t, i);
+		}
+		list_remove(t, &t->lru, LRU, i);
+	} else {
+		if (t->count < t->size) {
+			i = t->count++;
+		} else {
+			// Evict least recently seen remote
+			i = t->lru.tail;
+			if (t->remotes[i].pending) {
+				report(t, i);
+			}
+			list_remove(t, &t->lru, LRU, i);
+			hash_remove(t, i);
+		}
+		r = &t->remotes[i];
+		r->addr = addr;
+		r->hash_next = t->buckets[hash_addr(addr, t->bucket_bits)];
+		t->buckets[hash_addr(addr, t->bucket_bits)] = i;
+		known = false;
+	}
+
+	r->ev = *ev;
+	r->ev.repeats = 0;
+	r->ev.regress = known && (int16_t) (rolling_code - r->rolling_code) <= 0;
+	r->ev.last_rolling_code = known ? r->rolling_code : 0;
+	r->rolling_code = rolling_code;
+	r->last_seen = now;
+	r->pending = true;
+	list_push_tail(t, &t->pending, PEND, i);
+	list_push_head(t, &t->lru, LRU, i);
+}
@@ -0,0 +1,92 @@
+/**
+ * somfy_track.h - Somfy remote tracking and repeat suppression
+ *
+ * Remotes send every frame multiple times. The tracker collapses copies of a
+ * frame that follow each other within a time window into a single event with a
+ * repeat count, and flags events whose rolling code is not higher than the one
+ * of the previous event of the same remote.
+ *
+ * An event is reported when no copy is received for a whole window, when the
+ * remote sends an other frame, or when the remote is evicted. The state of at
+ * most a fixed number of remotes is kept, the least recently seen remote is
+ * evicted to make room for a new one.
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SOMFY_TRACK_H__
+#define __SOMFY_TRACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "somfy.h"
+
+// Default number of remotes tracked
+#define SOMFY_TRACK_SIZE 1024
+// Default repeat window in microseconds
+#define SOMFY_TRACK_WINDOW 500000
+
+typedef void (*somfy_event_cb_t)(void *arg, const struct somfy_event *ev);
+
+struct somfy_track;
+
+/**
+ * Create tracker
+ *
+ * @param size		Maximum number of remotes tracked
+ * @param window	Maximum time between copies of a frame
+ *
+ * @returns	New tracker, or NULL on error with errno set
+ */
+struct somfy_track *somfy_track_new(size_t size, uint64_t window,
+					somfy_event_cb_t cb, void *cb_arg);
+
+void somfy_track_free(struct somfy_track *t);
+
+/**
+ * Add received frame
+ *
+ * Frames with a wrong checksum are reported right away. Reports all events
+ * that expire at or before now first. The repeat and rolling code fields of ev
+ * are filled in by the tracker, the other fields are kept from the first copy.
+ *
+ * @param now	Time of frame, in the same unit as the window. Must not
+ *		decrease between calls.
+ */
+void somfy_track_frame(struct somfy_track *t, const struct somfy_event *ev,
+			uint64_t now);
+
+/**
+ * Report events of which the window ended at or before now
+ */
+void somfy_track_expire(struct somfy_track *t, uint64_t now);
+
+/**
+ * Report all pending events
+ */
+void somfy_track_flush(struct somfy_track *t);
+
+#endif // __SOMFY_TRACK_H__
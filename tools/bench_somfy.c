@@ -0,0 +1,549 @@
+/**
+ * bench_somfy.c - Benchmark the Somfy RTS decoding pipeline
+ *
+ * Generates a Somfy RTS signal as AM levels, see somfy_gen.h, and runs it
+ * through the same stages as decode_somfy_am: optionally detect preambles,
+ * threshold and down-sample,
+ * optionally low-pass filter, scan for level changes and decode. Every stage
+ * runs on the complete output of the previous stage and is timed separately,
+ * the best of a number of runs is reported.
+ *
+ * The decoded frames are compared with the generated ones. To tell apart
+ * frames lost in the signal, because of jitter or bit errors, from frames lost
+ * by slicing the AM levels, the generated levels are also decoded directly.
+ *
+ * The results are written to stdout as JSON, one object per line and stage,
+ * so they can be collected to track the performance over time:
+ *   stage		"detect", "slice", "filter", "scan", "decode" or
+ *			"reference"
+ *   label		Label given with -L, if any
+ *   seconds		Run time of the stage
+ *   samples, bits	Input of the detect and slice, and of the filter and
+ *			scan stages
+ *   msps		Million input samples or bits per second
+ *   edges		Level changes found by the scan stage
+ *   edges_per_s	Level changes scanned or decoded per second
+ *   frames		Frames reported by the decoder, including repeats
+ *   frames_per_s	Frames decoded per second
+ *   copies_sent	Number of frames transmitted, including repeats
+ *   copies_ok		Number of transmitted frames decoded correctly
+ *   frames_sent	Number of different frames transmitted
+ *   frames_ok		Number of different frames decoded at least once
+ *   bad		Number of decoded frames that weren't transmitted
+ *   success		frames_ok / frames_sent
+ *
+ * Usage:
+ * ------
+ *   ./tools/bench_somfy -n 100 -N 0x2000 -L $(git rev-parse --short HEAD) \
+ *      >> bench.jsonl
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "edge_scan.h"
+#include "lpf.h"
+#include "ook_slicer.h"
+#include "somfy_detect.h"
+#include "somfy.h"
+#include "somfy_gen.h"
+
+#define NFRAMES 100
+#define DOWNSAMPLE_RATE 10
+#define RUNS 3
+#define ADDRESS 0x123456
+
+struct frame_log {
+	somfy_frame_t *frames;
+	size_t len;
+	size_t size;
+};
+
+struct edge_log {
+	uint8_t *levels;
+	uint64_t *lens;
+	size_t len;
+	size_t size;
+};
+
+const char *label = NULL;
+int runs = RUNS;
+
+void usage(char *my_name) {
+	fprintf(stderr, "Benchmark Somfy RTS decoding\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s [options]\n", my_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, " -n <frames> Number of frames to generate (default: "
+			"%d)\n", NFRAMES);
+	fprintf(stderr, " -d <ratio>  Down-sample with given ratio (default: "
+			"%d)\n", DOWNSAMPLE_RATE);
+	fprintf(stderr, " -t <level>  Threshold (default: half the gain)\n");
+	fprintf(stderr, " -A          Use adaptive threshold instead of -t\n");
+	fprintf(stderr, " -M <level>  Detect preambles with given minimal "
+			"level, instead of -t and -A\n");
+	fprintf(stderr, " -l          Low-pass filter the sliced bits\n");
+	fprintf(stderr, " -j <pct>    Maximum pulse length jitter in percent "
+			"(default: 0)\n");
+	fprintf(stderr, " -e <rate>   Probability of a wrong sample "
+			"(default: 0)\n");
+	fprintf(stderr, " -g <level>  AM level of the carrier (default: "
+			"0x%x)\n", SOMFY_GEN_GAIN);
+	fprintf(stderr, " -N <level>  Maximum AM noise level (default: 0)\n");
+	fprintf(stderr, " -x <seed>   Seed of random number generator "
+			"(default: 1)\n");
+	fprintf(stderr, " -r <runs>   Time every stage this many times, the "
+			"best is reported\n");
+	fprintf(stderr, "             (default: %d)\n", RUNS);
+	fprintf(stderr, " -L <label>  Add label to results, like a version\n");
+	fprintf(stderr, " -h          Display this help\n");
+}
+
+/* Monotonic time in seconds */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+	if ((p = realloc(p, size)) == NULL) {
+		perror("Failed allocating memory");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static void log_frame(void *arg, somfy_frame_t frame, uint64_t start,
+			uint64_t end)
+{
+	struct frame_log *log = (struct frame_log *) arg;
+
+	(void) start;
+	(void) end;
+
+	if (log->len == log->size) {
+		log->size = log->size ? log->size * 2 : 1024;
+		log->frames = xrealloc(log->frames,
+					log->size * sizeof(*log->frames));
+	}
+	log->frames[log->len++] = frame;
+}
+
+static void log_edge(void *arg, int new_level, uint64_t len)
+{
+	struct edge_log *log = (struct edge_log *) arg;
+
+	if (log->len == log->size) {
+		log->size = log->size ? log->size * 2 : 65536;
+		log->levels = xrealloc(log->levels, log->size);
+		log->lens = xrealloc(log->lens, log->size * sizeof(uint64_t));
+	}
+	log->levels[log->len] = new_level;
+	log->lens[log->len++] = len;
+}
+
+static void level_change_cb(void *arg, int new_level, uint64_t len)
+{
+	somfy_decoder_level_change((struct somfy_decoder *) arg, new_level, len);
+}
+
+static void count_edge(void *arg, int new_level, uint64_t len)
+{
+	(void) new_level;
+	(void) len;
+
+	(*(uint64_t *) arg)++;
+}
+
+static void print_start(const char *stage)
+{
+	const char *p;
+
+	printf("{");
+	if (label != NULL) {
+		printf("\"label\":\"");
+		for (p = label; *p != '\0'; p++) {
+			if (*p == '"' || *p == '\\')
+				putchar('\\');
+			putchar(*p);
+		}
+		printf("\",");
+	}
+	printf("\"stage\":\"%s\"", stage);
+}
+
+/*
+ * Compare decoded frames with the transmitted ones and print the result
+ *
+ * The decoded frames are in transmission order and all transmitted frames
+ * differ, so every frame is only searched from the last matched one on.
+ */
+static void print_check(const struct frame_log *log,
+			const somfy_frame_t *sent, size_t nsent,
+			unsigned int copies)
+{
+	size_t copies_ok = 0;
+	size_t frames_ok = 0;
+	size_t bad = 0;
+	size_t j = 0;
+	size_t m;
+	bool seen = false;
+	size_t i;
+
+	for (i = 0; i < log->len; i++) {
+		for (m = j; m < nsent && log->frames[i] != sent[m]; m++)
+			;
+		if (m == nsent) {
+			bad++;
+			continue;
+		}
+		if (m != j) {
+			j = m;
+			seen = false;
+		}
+		copies_ok++;
+		if (! seen) {
+			frames_ok++;
+			seen = true;
+		}
+	}
+
+	printf(",\"copies_sent\":%zu,\"copies_ok\":%zu,\"frames_sent\":%zu,"
+		"\"frames_ok\":%zu,\"bad\":%zu,\"success\":%.4f",
+		nsent * copies, copies_ok, nsent, frames_ok, bad,
+		nsent ? (double) frames_ok / nsent : 0);
+}
+
+/* Decode levels, one byte per sample */
+static void decode_levels(const uint8_t *levels, size_t n,
+			const struct somfy_classifier *cls,
+			struct frame_log *log)
+{
+	struct somfy_decoder dec;
+	struct edge_scan es;
+	uint64_t w = 0;
+	size_t i;
+
+	somfy_decoder_init(&dec, cls, log_frame, log);
+	edge_scan_init(&es, level_change_cb, &dec);
+	for (i = 0; i < n; i++) {
+		w = (w << 1) | levels[i];
+		if ((i & 63) == 63) {
+			edge_scan_push(&es, &w, 64);
+		}
+	}
+	if ((n & 63) != 0) {
+		w <<= 64 - (n & 63);
+		edge_scan_push(&es, &w, n & 63);
+	}
+	edge_scan_flush(&es);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned long nframes = NFRAMES;
+	int downsample_rate = DOWNSAMPLE_RATE;
+	long threshold = -1;
+	bool adaptive = false;
+	bool use_lpf = false;
+	uint16_t min_level = 0;
+	double jitter = 0;
+	double error_rate = 0;
+	uint16_t gain = SOMFY_GEN_GAIN;
+	uint16_t noise = 0;
+	uint64_t seed = 1;
+
+	struct somfy_gen g;
+	struct somfy_classifier cls;
+	struct somfy_classifier ref_cls;
+	struct somfy_detect detect;
+	struct ook_slicer slicer;
+	struct somfy_decoder dec;
+	struct edge_scan es;
+	struct lpf lpf;
+	struct frame_log ref_log = { NULL, 0, 0 };
+	struct frame_log log = { NULL, 0, 0 };
+	struct edge_log edges = { NULL, NULL, 0, 0 };
+	somfy_frame_t *sent;
+	uint8_t *levels;
+	uint16_t *am;
+	uint16_t *detected;
+	uint64_t *words;
+	uint64_t *filtered = NULL;
+	const uint64_t *bits;
+	size_t nsamples = 0;
+	size_t nwords;
+	size_t nbits = 0;
+	uint64_t nedges = 0;
+	uint16_t rc;
+	double t, best;
+	unsigned long k;
+	size_t i;
+	int run;
+
+	while ((opt = getopt(argc, argv, "n:d:t:AM:lj:e:g:N:x:r:L:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			downsample_rate = strtol(optarg, NULL, 0);
+			if (downsample_rate <= 0) {
+				downsample_rate = 1;
+			}
+			break;
+		case 't':
+			threshold = strtol(optarg, NULL, 0);
+			break;
+		case 'A':
+			adaptive = true;
+			break;
+		case 'M':
+			min_level = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			use_lpf = true;
+			break;
+		case 'j':
+			jitter = strtod(optarg, NULL) / 100;
+			break;
+		case 'e':
+			error_rate = strtod(optarg, NULL);
+			break;
+		case 'g':
+			gain = strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			noise = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			runs = strtol(optarg, NULL, 0);
+			if (runs <= 0) {
+				runs = 1;
+			}
+			break;
+		case 'L':
+			label = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default: /* '?' */
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (threshold < 0) {
+		threshold = gain / 2;
+	}
+
+	// Generate signal
+	somfy_gen_init(&g, SOMFY_SAMPLE_RATE * downsample_rate, seed);
+	g.jitter = jitter;
+	g.error_rate = error_rate;
+	g.gain = gain;
+	g.noise = noise;
+
+	sent = malloc(nframes * sizeof(*sent));
+	levels = malloc(nframes * somfy_gen_max_samples(&g));
+	if (sent == NULL || levels == NULL) {
+		perror("Failed allocating signal");
+		exit(EXIT_FAILURE);
+	}
+	for (k = 0; k < nframes; k++) {
+		rc = k;
+		sent[k] = somfy_frame_new(0xA0 | (rc & 0xF), 0x2, rc, ADDRESS);
+		nsamples += somfy_gen_frame(&g, sent[k], &levels[nsamples]);
+	}
+
+	am = malloc(nsamples * sizeof(uint16_t));
+	words = malloc(ook_slicer_max_words(nsamples) * sizeof(uint64_t));
+	if (am == NULL || words == NULL) {
+		perror("Failed allocating buffers");
+		exit(EXIT_FAILURE);
+	}
+	somfy_gen_am(&g, levels, nsamples, am);
+
+	if (somfy_classifier_init(&cls, SOMFY_SAMPLE_RATE,
+					SOMFY_SYMBOL_TIME) != 0 ||
+	    somfy_classifier_init(&ref_cls, SOMFY_SAMPLE_RATE * downsample_rate,
+					SOMFY_SYMBOL_TIME) != 0) {
+		perror("Failed building pulse classifier");
+		exit(EXIT_FAILURE);
+	}
+
+	// Reference: is the generated signal decodable at all
+	decode_levels(levels, nsamples, &ref_cls, &ref_log);
+	free(levels);
+
+	// Pass on detected transmissions only
+	if (min_level != 0) {
+		detected = malloc(nsamples * sizeof(uint16_t));
+		if (detected == NULL) {
+			perror("Failed allocating buffers");
+			exit(EXIT_FAILURE);
+		}
+		best = 0;
+		for (run = 0; run < runs; run++) {
+			if (somfy_detect_init(&detect,
+					SOMFY_SAMPLE_RATE * downsample_rate,
+					SOMFY_SYMBOL_TIME, min_level) != 0) {
+				perror("Failed setting up preamble detection");
+				exit(EXIT_FAILURE);
+			}
+			t = now();
+			i = somfy_detect_push(&detect, am, nsamples, detected);
+			somfy_detect_flush(&detect, &detected[i]);
+			t = now() - t;
+			somfy_detect_free(&detect);
+			if (run == 0 || t < best)
+				best = t;
+		}
+		print_start("detect");
+		printf(",\"seconds\":%.6f,\"samples\":%zu,\"msps\":%.3f}\n",
+				best, nsamples, nsamples / best / 1e6);
+		free(am);
+		am = detected;
+		threshold = SOMFY_DETECT_THRESHOLD;
+		adaptive = false;
+	}
+
+	// Threshold and down-sample
+	best = 0;
+	for (run = 0; run < runs; run++) {
+		ook_slicer_init(&slicer, threshold, downsample_rate);
+		if (adaptive) {
+			ook_slicer_set_adaptive(&slicer, 20);
+		}
+		t = now();
+		nwords = ook_slicer_push(&slicer, am, nsamples, words);
+		nbits = nwords * 64 + ook_slicer_flush(&slicer, &words[nwords]);
+		t = now() - t;
+		if (run == 0 || t < best)
+			best = t;
+	}
+	print_start("slice");
+	printf(",\"seconds\":%.6f,\"samples\":%zu,\"msps\":%.3f}\n", best,
+			nsamples, nsamples / best / 1e6);
+	free(am);
+	bits = words;
+
+	if (use_lpf) {
+		filtered = malloc((nbits + 63) / 64 * sizeof(uint64_t));
+		if (filtered == NULL) {
+			perror("Failed allocating buffers");
+			exit(EXIT_FAILURE);
+		}
+		best = 0;
+		for (run = 0; run < runs; run++) {
+			memcpy(filtered, words, (nbits + 63) / 64 * sizeof(uint64_t));
+			lpf_init(&lpf, LPF_DEPTH, LPF_LOW, LPF_HIGH);
+			t = now();
+			lpf_filter(&lpf, filtered, nbits);
+			t = now() - t;
+			if (run == 0 || t < best)
+				best = t;
+		}
+		print_start("filter");
+		printf(",\"seconds\":%.6f,\"bits\":%zu,\"msps\":%.3f}\n",
+				best, nbits, nbits / best / 1e6);
+		bits = filtered;
+	}
+
+	// Scan for level changes
+	best = 0;
+	for (run = 0; run < runs; run++) {
+		nedges = 0;
+		edge_scan_init(&es, count_edge, &nedges);
+		t = now();
+		edge_scan_push(&es, bits, nbits);
+		edge_scan_flush(&es);
+		t = now() - t;
+		if (run == 0 || t < best)
+			best = t;
+	}
+	print_start("scan");
+	printf(",\"seconds\":%.6f,\"bits\":%zu,\"msps\":%.3f,\"edges\":%ju,"
+		"\"edges_per_s\":%.0f}\n", best, nbits, nbits / best / 1e6,
+		(uintmax_t) nedges, nedges / best);
+
+	// Decode the level changes
+	edge_scan_init(&es, log_edge, &edges);
+	edge_scan_push(&es, bits, nbits);
+	edge_scan_flush(&es);
+
+	best = 0;
+	for (run = 0; run < runs; run++) {
+		log.len = 0;
+		somfy_decoder_init(&dec, &cls, log_frame, &log);
+		t = now();
+		for (i = 0; i < edges.len; i++) {
+			somfy_decoder_level_change(&dec, edges.levels[i],
+							edges.lens[i]);
+		}
+		t = now() - t;
+		if (run == 0 || t < best)
+			best = t;
+	}
+	print_start("decode");
+	printf(",\"seconds\":%.6f,\"edges\":%zu,\"edges_per_s\":%.0f,"
+		"\"frames\":%zu,\"frames_per_s\":%.0f", best, edges.len,
+		edges.len / best,
+		log.len, log.len / best);
+	print_check(&log, sent, nframes, g.copies);
+	printf("}\n");
+
+	print_start("reference");
+	printf(",\"frames\":%zu", ref_log.len);
+	print_check(&ref_log, sent, nframes, g.copies);
+	printf("}\n");
+
+	somfy_classifier_free(&cls);
+	somfy_classifier_free(&ref_cls);
+	free(edges.levels);
+	free(edges.lens);
+	free(log.frames);
+	free(ref_log.frames);
+	free(filtered);
+	free(words);
+	free(sent);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,283 @@
+/**
+ * gen_somfy.c - Generate Somfy RTS signals
+ *
+ * Writes the signal of a number of Somfy RTS transmissions as packed bit
+ * stream, like am_to_ook writes, or as 16-bit AM levels, like rtl_fm -M am
+ * writes. This gives reproducible input to test the decoders with. Pulse
+ * length jitter, bit errors, gain and noise can be added to the signal.
+ *
+ * Every frame has the next rolling code, the encryption key follows the
+ * rolling code like it does for real remotes. With -R the frames are spread
+ * over multiple remotes, with consecutive addresses.
+ *
+ * Usage:
+ * ------
+ *   ./tools/gen_somfy -n 10 | ./decoders/decode_somfy
+ *   ./tools/gen_somfy -f am -N 500 | ./decoders/decode_somfy_am -t 0x3000
+ *
+ * Copyright (c) 2014, David Imhoff <dimhoff.devel@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the author nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "somfy.h"
+#include "somfy_gen.h"
+
+#define ADDRESS 0x123456
+#define CONTROL 0x2
+// Down-sample ratio am_to_ook and decode_somfy_am use by default
+#define AM_OVERSAMPLE 10
+
+void usage(char *my_name) {
+	fprintf(stderr, "Generate Somfy RTS signal\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s [options] [<output>]\n", my_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, " -f <format> Output format: bits (packed bit stream) "
+			"or am (default: bits)\n");
+	fprintf(stderr, " -n <frames> Number of frames (default: 1)\n");
+	fprintf(stderr, " -a <addr>   Address of the first remote (default: "
+			"%06x)\n", ADDRESS);
+	fprintf(stderr, " -R <count>  Number of remotes sending the frames "
+			"(default: 1)\n");
+	fprintf(stderr, " -c <ctrl>   Control code (default: %x)\n", CONTROL);
+	fprintf(stderr, " -r <code>   Rolling code of the first frame "
+			"(default: 0)\n");
+	fprintf(stderr, " -C <copies> Copies of every frame (default: %d)\n",
+			SOMFY_GEN_COPIES);
+	fprintf(stderr, " -s <rate>   Sample rate in Hz (default: %d, or %d "
+			"for am)\n", SOMFY_SAMPLE_RATE,
+			SOMFY_SAMPLE_RATE * AM_OVERSAMPLE);
+	fprintf(stderr, " -S <us>     Symbol time in microseconds (default: "
+			"%d)\n", SOMFY_SYMBOL_TIME);
+	fprintf(stderr, " -j <pct>    Maximum pulse length jitter in percent "
+			"(default: 0)\n");
+	fprintf(stderr, " -e <rate>   Probability of a wrong sample "
+			"(default: 0)\n");
+	fprintf(stderr, " -g <level>  AM level of the carrier (default: "
+			"0x%x)\n", SOMFY_GEN_GAIN);
+	fprintf(stderr, " -N <level>  Maximum AM noise level (default: 0)\n");
+	fprintf(stderr, " -x <seed>   Seed of random number generator "
+			"(default: 1)\n");
+	fprintf(stderr, " -v          Print generated frames to stderr\n");
+	fprintf(stderr, " -h          Display this help\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "When output is not specified or equal to '-', stdout "
+			"is used\n");
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *ofp = stdout;
+	int opt;
+	bool am_output = false;
+	bool verbose = false;
+	unsigned long nframes = 1;
+	uint32_t addr = ADDRESS;
+	unsigned int nremotes = 1;
+	uint8_t control = CONTROL;
+	uint16_t rolling_code = 0;
+	uint32_t sample_rate = 0;
+	uint64_t seed = 1;
+	struct somfy_gen g;
+	uint32_t symbol_time = SOMFY_SYMBOL_TIME;
+	unsigned int copies = SOMFY_GEN_COPIES;
+	double jitter = 0;
+	double error_rate = 0;
+	uint16_t gain = SOMFY_GEN_GAIN;
+	uint16_t noise = 0;
+
+	somfy_frame_t frame;
+	uint16_t rc;
+	uint8_t *levels;
+	uint16_t *am = NULL;
+	uint8_t *obuf = NULL;
+	uint8_t byte = 0;
+	int nbits = 0;
+	size_t n, olen, i;
+	unsigned long k;
+
+	while ((opt = getopt(argc, argv, "f:n:a:R:c:r:C:s:S:j:e:g:N:x:vh")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (strcmp(optarg, "am") == 0) {
+				am_output = true;
+			} else if (strcmp(optarg, "bits") == 0) {
+				am_output = false;
+			} else {
+				fprintf(stderr, "Unknown output format: %s\n",
+						optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			addr = strtoul(optarg, NULL, 16) & 0xFFFFFF;
+			break;
+		case 'R':
+			nremotes = strtoul(optarg, NULL, 0);
+			if (nremotes == 0) {
+				nremotes = 1;
+			}
+			break;
+		case 'c':
+			control = strtoul(optarg, NULL, 16) & 0xF;
+			break;
+		case 'r':
+			rolling_code = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			copies = strtoul(optarg, NULL, 0);
+			if (copies == 0) {
+				copies = 1;
+			}
+			break;
+		case 's':
+			sample_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			symbol_time = strtoul(optarg, NULL, 0);
+			if (symbol_time == 0) {
+				symbol_time = SOMFY_SYMBOL_TIME;
+			}
+			break;
+		case 'j':
+			jitter = strtod(optarg, NULL) / 100;
+			break;
+		case 'e':
+			error_rate = strtod(optarg, NULL);
+			break;
+		case 'g':
+			gain = strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			noise = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default: /* '?' */
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind > 1) {
+		fprintf(stderr, "Too many arguments\n");
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (argc - optind > 0 && strcmp(argv[optind], "-") != 0) {
+		if ((ofp = fopen(argv[optind], "wb")) == NULL) {
+			perror("Failed opening output file");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (sample_rate == 0) {
+		sample_rate = SOMFY_SAMPLE_RATE;
+		if (am_output) {
+			sample_rate *= AM_OVERSAMPLE;
+		}
+	}
+	somfy_gen_init(&g, sample_rate, seed);
+	g.symbol_time = symbol_time;
+	g.copies = copies;
+	g.jitter = jitter;
+	g.error_rate = error_rate;
+	g.gain = gain;
+	g.noise = noise;
+
+	levels = malloc(somfy_gen_max_samples(&g));
+	if (am_output) {
+		am = malloc(somfy_gen_max_samples(&g) * sizeof(uint16_t));
+	} else {
+		obuf = malloc(somfy_gen_max_samples(&g) / 8 + 1);
+	}
+	if (levels == NULL || (am == NULL && obuf == NULL)) {
+		perror("Failed allocating buffers");
+		exit(EXIT_FAILURE);
+	}
+
+	for (k = 0; k < nframes; k++) {
+		rc = rolling_code + k / nremotes;
+		frame = somfy_frame_new(0xA0 | (rc & 0xF), control, rc,
+					(addr + k % nremotes) & 0xFFFFFF);
+		if (verbose) {
+			somfy_print_frame_oneline(stderr, frame, 1);
+		}
+
+		n = somfy_gen_frame(&g, frame, levels);
+		if (am_output) {
+			somfy_gen_am(&g, levels, n, am);
+			if (fwrite(am, sizeof(uint16_t), n, ofp) != n) {
+				perror("Failed writing output");
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+
+		// Pack, the last partial byte continues with the next frame
+		olen = 0;
+		for (i = 0; i < n; i++) {
+			byte = (byte << 1) | levels[i];
+			if (++nbits == 8) {
+				obuf[olen++] = byte;
+				nbits = 0;
+			}
+		}
+		if (fwrite(obuf, 1, olen, ofp) != olen) {
+			perror("Failed writing output");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (nbits != 0) {
+		byte <<= 8 - nbits;
+		fwrite(&byte, 1, 1, ofp);
+	}
+
+	free(levels);
+	free(am);
+	free(obuf);
+	if (fclose(ofp) != 0) {
+		perror("Failed writing output");
+		exit(EXIT_FAILURE);
+	}
+	return EXIT_SUCCESS;
+}